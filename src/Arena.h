@@ -0,0 +1,199 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// An Arena is a simple bump allocator for short-lived temporaries.
+// Allocation just moves a pointer along a large chunk of memory, and 
+// nothing is returned to the system until the arena is destroyed.
+// Instead, an ArenaScope marks the current position when it is 
+// constructed, and rewinds the arena to that position when it goes out
+// of scope, so the same memory is reused for the next galaxy.
+//
+// Each thread has its own arena (see getThreadArena), so there is no 
+// locking, and no contention with other threads in malloc.
+//
+// Note: Anything allocated from an arena while an ArenaScope is active
+// must not be used after that scope ends.  Allocations made when no
+// scope is active go to the normal heap, as do all allocations from a 
+// default constructed ArenaAllocator.
+
+#include <vector>
+#include <cstddef>
+#include <new>
+#include "dbg.h"
+
+class Arena
+{
+public :
+
+    Arena(size_t chunk_size=ARENA_CHUNK_SIZE);
+    ~Arena();
+
+    // Get the arena for the current thread.  (Defined in Arena_omp.cpp.)
+    static Arena& getThreadArena();
+
+    void* allocate(size_t n);
+
+    // Only the most recent allocation is actually freed.  This is the 
+    // usual pattern when a vector grows by push_back, so it helps keep
+    // the arena from filling up with dead copies.
+    void deallocate(void* p, size_t n);
+
+    // Is p in memory that belongs to this arena?
+    bool owns(const void* p) const;
+
+    bool inScope() const { return _nscope > 0; }
+
+    // Total memory held by the arena.
+    size_t getCapacity() const;
+    // The most that has been in use at once.
+    size_t getHighWater() const { return _high_water; }
+
+    enum { ARENA_CHUNK_SIZE = 1024*1024 }; // 1 MB
+    enum { ALIGN = 64 };
+
+private :
+
+    friend class ArenaScope;
+
+    struct Chunk 
+    {
+        char* start;
+        size_t size;
+    };
+
+    // The position in the arena is the current chunk and the offset 
+    // within that chunk.
+    struct Mark
+    {
+        int chunk;
+        size_t offset;
+    };
+
+    Mark getMark() const { Mark m; m.chunk = _cur; m.offset = _offset; return m; }
+    void release(const Mark& m) { _cur = m.chunk; _offset = m.offset; }
+
+    size_t _chunk_size;
+    std::vector<Chunk> _chunks;
+    int _cur;
+    size_t _offset;
+    size_t _used;
+    size_t _high_water;
+    int _nscope;
+
+    // Copy and assign are not defined:
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+};
+
+// While an ArenaScope exists, ArenaAllocators for the same arena take 
+// their memory from the arena.  When it is destroyed, all of that memory
+// is made available again.  Scopes can be nested.
+class ArenaScope
+{
+public :
+
+    ArenaScope(Arena& arena=Arena::getThreadArena()) :
+        _arena(arena), _mark(arena.getMark()), _used(arena._used)
+    { ++_arena._nscope; }
+
+    ~ArenaScope() 
+    { 
+        _arena.release(_mark); 
+        _arena._used = _used;
+        --_arena._nscope; 
+    }
+
+private :
+
+    Arena& _arena;
+    Arena::Mark _mark;
+    size_t _used;
+
+    ArenaScope(const ArenaScope&);
+    ArenaScope& operator=(const ArenaScope&);
+};
+
+// A standard library allocator that uses an arena, normally the thread's
+// arena: e.g. std::vector<T,ArenaAllocator<T> > v(
+//                 ArenaAllocator<T>(Arena::getThreadArena()));
+// A default constructed ArenaAllocator just uses new and delete, so the
+// same container type can be used either way.
+// (Like PoolAllocator, most of the names here are mandated by the 
+// standard library.)
+template <typename T> class ArenaAllocator;
+
+template <> class ArenaAllocator<void>
+{
+public:
+
+    typedef void* pointer;
+    typedef const void* const_pointer;
+    typedef void value_type;
+
+    template <class U>
+    struct rebind { typedef ArenaAllocator<U> other; };
+};
+
+template <typename T>
+class ArenaAllocator
+{
+public:
+
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef T value_type;
+
+    template <class U> 
+    struct rebind { typedef ArenaAllocator<U> other; };
+
+    ArenaAllocator() : _arena(0) {}
+    explicit ArenaAllocator(Arena& arena) : _arena(&arena) {}
+    template <class U> 
+    ArenaAllocator(const ArenaAllocator<U>& rhs) : _arena(rhs.getArena()) {}
+
+    pointer address(reference x) const { return &x; }
+    const_pointer address(const_reference x) const { return &x; }
+
+    pointer allocate(
+        size_type n, typename ArenaAllocator<void>::const_pointer = 0)
+    {
+        if (_arena && _arena->inScope()) 
+            return static_cast<pointer>(_arena->allocate(n*sizeof(T)));
+        else 
+            return static_cast<pointer>(::operator new(n*sizeof(T)));
+    }
+
+    void deallocate(pointer p, size_type n)
+    {
+        if (_arena && _arena->owns(p)) _arena->deallocate(p,n*sizeof(T));
+        else ::operator delete(p);
+    }
+
+    size_type max_size() const throw() 
+    { return size_t(-1) / sizeof(value_type); }
+
+    void construct(pointer p, const T& val)
+    { new(static_cast<void*>(p)) T(val); }
+
+    void destroy(pointer p) { p->~T(); }
+
+    Arena* getArena() const { return _arena; }
+
+private:
+
+    Arena* _arena;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a1, const ArenaAllocator<U>& a2)
+{ return a1.getArena() == a2.getArena(); }
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a1, const ArenaAllocator<U>& a2)
+{ return a1.getArena() != a2.getArena(); }
+
+#endif
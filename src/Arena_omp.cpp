@@ -0,0 +1,96 @@
+
+#include <algorithm>
+#include "Arena.h"
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+Arena::Arena(size_t chunk_size) :
+    _chunk_size(chunk_size), _cur(-1), _offset(0), 
+    _used(0), _high_water(0), _nscope(0)
+{}
+
+Arena::~Arena()
+{
+    Assert(_nscope == 0);
+    const int nchunks = _chunks.size();
+    for(int i=0;i<nchunks;++i) ::operator delete(_chunks[i].start);
+}
+
+void* Arena::allocate(size_t n)
+{
+    // Round up to keep everything aligned.
+    n = (n + ALIGN - 1) / ALIGN * ALIGN;
+    if (_cur < 0 || _offset + n > _chunks[_cur].size) {
+        // Move on to the next chunk that is big enough, or make a new one.
+        // Any smaller chunks that we skip are just left unused until the 
+        // arena is rewound.
+        const int nchunks = _chunks.size();
+        do { ++_cur; } while (_cur < nchunks && _chunks[_cur].size < n);
+        if (_cur == nchunks) {
+            Chunk c;
+            c.size = std::max(n,_chunk_size);
+            // operator new is only guaranteed to align to 16 bytes, so
+            // ask for a bit more and align the start ourselves.
+            c.start = static_cast<char*>(::operator new(c.size + ALIGN));
+            _chunks.push_back(c);
+            xdbg<<"Arena: new chunk of size "<<c.size<<std::endl;
+        }
+        _offset = 0;
+    }
+    char* start = _chunks[_cur].start;
+    size_t shift = (ALIGN - size_t(start) % ALIGN) % ALIGN;
+    void* p = start + shift + _offset;
+    _offset += n;
+    _used += n;
+    if (_used > _high_water) _high_water = _used;
+    return p;
+}
+
+void Arena::deallocate(void* p, size_t n)
+{
+    n = (n + ALIGN - 1) / ALIGN * ALIGN;
+    if (_cur >= 0 && _offset >= n) {
+        char* start = _chunks[_cur].start;
+        size_t shift = (ALIGN - size_t(start) % ALIGN) % ALIGN;
+        if (static_cast<char*>(p) == start + shift + _offset - n) {
+            _offset -= n;
+            _used -= n;
+        }
+    }
+}
+
+bool Arena::owns(const void* p) const
+{
+    const char* cp = static_cast<const char*>(p);
+    const int nchunks = _chunks.size();
+    for(int i=0;i<nchunks;++i) {
+        const Chunk& c = _chunks[i];
+        if (cp >= c.start && cp < c.start + c.size + ALIGN) return true;
+    }
+    return false;
+}
+
+size_t Arena::getCapacity() const
+{
+    size_t cap = 0;
+    const int nchunks = _chunks.size();
+    for(int i=0;i<nchunks;++i) cap += _chunks[i].size;
+    return cap;
+}
+
+// Each thread gets its own arena the first time it asks for one.
+// These are never deleted, since OpenMP keeps its threads around for
+// the life of the program anyway.
+static Arena* thread_arena = 0;
+#ifdef _OPENMP
+#pragma omp threadprivate(thread_arena)
+#endif
+
+Arena& Arena::getThreadArena()
+{
+    if (!thread_arena) thread_arena = new Arena();
+    return *thread_arena;
+}
+
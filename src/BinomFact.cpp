@@ -0,0 +1,96 @@
+
+#include <cassert>
+#include <cmath>
+#include "BinomFact.h"
+
+// All the tables are filled in once by the constructor.  
+// Since nothing writes to them after that, they can be read by any 
+// number of threads at once.
+struct BinomFactTables
+{
+    enum { N = BINOMFACT_MAXN+1 };
+
+    double fact[N];
+    double sqrtfact[N];
+    double sqrtn[N];
+    // binom(i,j) is stored at binom[i*(i+1)/2 + j]
+    double binom[N*(N+1)/2];
+
+    BinomFactTables()
+    {
+        fact[0] = sqrtfact[0] = 1.;
+        sqrtn[0] = 0.;
+        for(int i=1;i<N;++i) {
+            fact[i] = fact[i-1]*(double)i;
+            sqrtn[i] = std::sqrt((double)i);
+            sqrtfact[i] = sqrtfact[i-1]*sqrtn[i];
+        }
+        binom[0] = 1.;
+        for(int i=1;i<N;++i) {
+            double* row = binom + i*(i+1)/2;
+            const double* prev = binom + (i-1)*i/2;
+            row[0] = row[i] = 1.;
+            for(int j=1;j<i;++j) row[j] = prev[j-1] + prev[j];
+        }
+    }
+};
+
+static const BinomFactTables& GetTables()
+{
+    // The tables are constructed the first time this is called.  
+    // Doing it this way (rather than with a global object) means it is 
+    // safe to use these functions during the static initialization of 
+    // some other file.  After the first call, this is just a check of
+    // the guard variable, not a lock.
+    static const BinomFactTables t;
+    return t;
+}
+
+// Make sure the tables are built at startup, before any threads start.
+static const BinomFactTables& init_tables = GetTables();
+
+double fact(int i)
+{
+    // return i!
+    assert(i>=0);
+    const BinomFactTables& tables = GetTables();
+    if (i < BinomFactTables::N) return tables.fact[i];
+    double f = tables.fact[BinomFactTables::N-1];
+    for(int j=BinomFactTables::N;j<=i;++j) f *= (double)j;
+    return f;
+}
+
+double sqrtfact(int i)
+{
+    // return sqrt(i!)
+    assert(i>=0);
+    const BinomFactTables& tables = GetTables();
+    if (i < BinomFactTables::N) return tables.sqrtfact[i];
+    double f = tables.sqrtfact[BinomFactTables::N-1];
+    for(int j=BinomFactTables::N;j<=i;++j) f *= std::sqrt((double)j);
+    return f;
+}
+
+double binom(int i,int j)
+{
+    // return iCj, i!/(j!(i-j)!)
+    assert(i>=0);
+    const BinomFactTables& tables = GetTables();
+    if (j<0 || j>i) return 0.;
+    if (i < BinomFactTables::N) return tables.binom[i*(i+1)/2 + j];
+    // Use the symmetry to keep the product short.
+    if (2*j > i) j = i-j;
+    double f = 1.;
+    for(int k=1;k<=j;++k) f = f * (double)(i-j+k) / (double)k;
+    return std::floor(f+0.5);
+}
+
+double sqrtn(int i)
+{
+    // return sqrt(i)
+    assert(i>=0);
+    const BinomFactTables& tables = GetTables();
+    if (i < BinomFactTables::N) return tables.sqrtn[i];
+    return std::sqrt((double)i);
+}
+
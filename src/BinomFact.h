@@ -1,7 +1,14 @@
-
 #ifndef BinomFactH
 #define BinomFactH
 
+// The values for i <= BINOMFACT_MAXN are precomputed when the program
+// starts, and are never changed after that, so these functions are safe 
+// to call from multiple threads without any locking.  
+// Larger values are calculated directly each time.
+#ifndef BINOMFACT_MAXN
+#define BINOMFACT_MAXN 200
+#endif
+
 double fact(int i);
 double sqrtfact(int i);
 double binom(int i,int j);
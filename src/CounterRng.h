@@ -0,0 +1,37 @@
+#ifndef CounterRng_H
+#define CounterRng_H
+
+// A counter-based random number generator.
+//
+// The n-th number for a given (seed, id) is just a hash of 
+// (seed, id, n), so each object gets its own stream, which doesn't 
+// depend on what other objects were measured before it or by which 
+// thread.  The hash is the splitmix64 finalizer.
+class CounterRng
+{
+public :
+
+    CounterRng(unsigned long seed, long id) : 
+        _key(mix(mix(seed) ^ (unsigned long long)(id))), _n(0) {}
+
+    // Returns a uniform deviate in [0,1).
+    double operator()() 
+    { return double(next() >> 11) * (1./9007199254740992.); }
+
+private :
+
+    static unsigned long long mix(unsigned long long z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    unsigned long long next()
+    { return mix(_key + 0x9e3779b97f4a7c15ULL * (++_n)); }
+
+    unsigned long long _key;
+    unsigned long long _n;
+};
+
+#endif
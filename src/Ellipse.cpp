@@ -1,6 +1,7 @@
 
 #include <cmath>
 #include <fstream>
+#include <memory>
 #include "Ellipse.h"
 #include "PsiHelper.h"
 #include "Params.h"
@@ -182,10 +183,130 @@ bool Ellipse::measure(
     const Ellipse* ell_meas)
 { return doMeasure(pix,0,order,order2,maxm,sigma,flag,thresh,cov,ell_meas); }
 
+bool Ellipse::measure(
+    const std::vector<PixelColumns>& pix,
+    const std::vector<BVec>& psf,
+    int order, int order2, int maxm,
+    double sigma, long& flag, double thresh, DSmallMatrix22* cov,
+    const Ellipse* ell_meas)
+{ return doMeasure(pix,&psf,order,order2,maxm,sigma,flag,thresh,cov,ell_meas); }
+
+bool Ellipse::measure(
+    const std::vector<PixelColumns>& pix,
+    int order, int order2, int maxm,
+    double sigma, long& flag, double thresh, DSmallMatrix22* cov,
+    const Ellipse* ell_meas)
+{ return doMeasure(pix,0,order,order2,maxm,sigma,flag,thresh,cov,ell_meas); }
+
+// Load the pixels for one exposure into the flat I, W vectors starting 
+// at index n, along with the positions in the frame of the ellipse:
+// z' = m ( z-zc - g (z-zc)* ) / sigma_obs
+static void LoadPixels(
+    const PixelList& pix, int n,
+    std::complex<double> cen, std::complex<double> gamma,
+    std::complex<double> m, double sigma_obs,
+    DVector& I, DVector& W, DVector& Zr, DVector& Zi)
+{
+    const int npix = pix.size();
+    for(int i=0;i<npix;++i,++n) {
+        I(n) = pix[i].getFlux()*pix[i].getInverseSigma();
+        W(n) = pix[i].getInverseSigma();
+        std::complex<double> z1 = pix[i].getPos();
+        std::complex<double> z2 = m*((z1-cen) - gamma*conj(z1-cen));
+        z2 /= sigma_obs;
+        Zr(n) = real(z2);
+        Zi(n) = imag(z2);
+    }
+}
+
+static void LoadPixels(
+    const PixelColumns& pix, int n,
+    std::complex<double> cen, std::complex<double> gamma,
+    std::complex<double> m, double sigma_obs,
+    DVector& I, DVector& W, DVector& Zr, DVector& Zi)
+{
+    const int npix = pix.size();
+    if (npix == 0) return;
+
+    // This is the same calculation as above, but written out in terms
+    // of the real and imaginary parts, so the compiler can vectorize it.
+    const PixelColumns::value_type* u = pix.getUArray();
+    const PixelColumns::value_type* v = pix.getVArray();
+    const PixelColumns::value_type* flux = pix.getFluxArray();
+    const PixelColumns::value_type* invsig = pix.getInverseSigmaArray();
+    double* Iit = TMV_ptr(I) + n;
+    double* Wit = TMV_ptr(W) + n;
+    double* Zrit = TMV_ptr(Zr) + n;
+    double* Ziit = TMV_ptr(Zi) + n;
+    const double uc = real(cen);
+    const double vc = imag(cen);
+    const double g1 = real(gamma);
+    const double g2 = imag(gamma);
+    const double mr = real(m);
+    const double mi = imag(m);
+    for(int i=0;i<npix;++i) {
+        double du = u[i] - uc;
+        double dv = v[i] - vc;
+        double wr = du - (g1*du + g2*dv);
+        double wi = dv - (g2*du - g1*dv);
+        Iit[i] = double(flux[i]) * double(invsig[i]);
+        Wit[i] = invsig[i];
+        Zrit[i] = (mr*wr - mi*wi) / sigma_obs;
+        Ziit[i] = (mr*wi + mi*wr) / sigma_obs;
+    }
+}
+
+void IncrementalPsi::makePsi(
+    int k, DMatrix& psi, const DVectorView& zr, const DVectorView& zi,
+    int order, const DVectorView& coeff,
+    std::complex<double> cen, std::complex<double> p, std::complex<double> q)
+{
+    if (k >= int(_base.size())) _base.resize(k+1);
+    Base& base = _base[k];
+    const int npix = zr.size();
+
+    if (base.order == order && base.npix == npix) {
+        // The base positions are w = L0(z-c0), where L(z) = p z + q z*.
+        // The new ones are
+        // z' = L(z-c) = L(L0^-1(w)) + L(c0-c)
+        //    = w + dz + alpha w + beta w*
+        // L0^-1(w) = (p0* w - q0 w*) / (|p0|^2-|q0|^2)
+        // So L(L0^-1(w)) = ((p p0* - q q0*) w + (q p0 - p q0) w*) / det
+        const double det = std::norm(base.p) - std::norm(base.q);
+        std::complex<double> alpha = 
+            (p*conj(base.p) - q*conj(base.q)) / det - 1.;
+        std::complex<double> beta = (q*base.p - p*base.q) / det;
+        std::complex<double> dz = p*(base.cen-cen) + q*conj(base.cen-cen);
+        double step = std::max(std::abs(dz),
+                               std::max(std::abs(alpha),std::abs(beta)));
+        xdbg<<"IncrementalPsi: k = "<<k<<", step = "<<step<<std::endl;
+        if (step <= _max_step) {
+            UpdatePsi(psi,*base.psi,order,dz,alpha,beta);
+            ++_nupdates;
+            return;
+        }
+    }
+
+    // Rebuild the base psi matrix at the current positions.
+    // UpdatePsi needs it to order+4.
+    base.order = order;
+    base.npix = npix;
+    base.cen = cen;
+    base.p = p;
+    base.q = q;
+    base.psi.reset(new DMatrix(npix,(order+5)*(order+6)/2));
+    MakePsi(*base.psi,zr,zi,order+4,&coeff);
+    const int size = (order+1)*(order+2)/2;
+    TMV_colRange(psi,0,size) = TMV_colRange(*base.psi,0,size);
+    ++_nrebuilds;
+}
+
+template <class PixList>
 bool Ellipse::doMeasureShapelet(
-    const std::vector<PixelList>& pix,
+    const std::vector<PixList>& pix,
     const std::vector<BVec>* psf, BVec& b,
-    int order, int order2, int maxm, DMatrix* bCov) const
+    int order, int order2, int maxm, DMatrix* bCov,
+    IncrementalPsi* inc) const
 {
     xdbg<<"Start MeasureShapelet: order = "<<order<<std::endl;
     xdbg<<"b.order, sigma = "<<b.getOrder()<<", "<<b.getSigma()<<std::endl;
@@ -224,7 +345,8 @@ bool Ellipse::doMeasureShapelet(
 
     DVector I(ntot);
     DVector W(ntot);
-    CDVector Z(ntot);
+    DVector Zr(ntot);
+    DVector Zi(ntot);
 
     for(int k=0,n=0;k<nexp;++k) {
         double sigma_obs = 
@@ -233,16 +355,11 @@ bool Ellipse::doMeasureShapelet(
             sigma;
         xdbg<<"sigma_obs["<<k<<"] = "<<sigma_obs<<std::endl;
 
-        const int npix = pix[k].size();
-        for(int i=0;i<npix;++i,++n) {
-            I(n) = pix[k][i].getFlux()*pix[k][i].getInverseSigma();
-            W(n) = pix[k][i].getInverseSigma();
-            std::complex<double> z1 = pix[k][i].getPos();
-            std::complex<double> z2 = mm*((z1-_cen) - _gamma*conj(z1-_cen));
-            Z(n) = z2 / sigma_obs;
-        }
+        LoadPixels(pix[k],n,_cen,_gamma,mm,sigma_obs,I,W,Zr,Zi);
+        n += pix[k].size();
     }
-    //xdbg<<"Z = "<<Z<<std::endl;
+    //xdbg<<"Zr = "<<Zr<<std::endl;
+    //xdbg<<"Zi = "<<Zi<<std::endl;
     //xdbg<<"I = "<<I<<std::endl;
     //xdbg<<"W = "<<W<<std::endl;
     
@@ -285,6 +402,12 @@ bool Ellipse::doMeasureShapelet(
     //xdbg<<"A = "<<A<<std::endl;
 
     if (psf) {
+        // The transformation matrices only depend on the frame and the 
+        // psf order, so they can usually be reused for all exposures.
+        int lastpsforder = -1;
+        std::auto_ptr<DMatrix> S;
+        std::auto_ptr<DMatrix> D;
+        std::auto_ptr<DBandMatrix> R;
         for(int k=0,n=0,nx;k<nexp;++k,n=nx) {
             xdbg<<"psf = "<<(*psf)[k]<<std::endl;
             int psforder = (*psf)[k].getOrder();
@@ -297,23 +420,32 @@ bool Ellipse::doMeasureShapelet(
             int psfsize = (*psf)[k].size();
             int newpsfsize = newpsf.size();
             xdbg<<"psfsize = "<<psfsize<<std::endl;
+            bool newtrans = (psforder != lastpsforder);
+            lastpsforder = psforder;
             bool setnew = false;
             if (_gamma != 0.) {
-                DMatrix S(newpsfsize,psfsize);
-                CalculateGTransform(_gamma,newpsforder,psforder,S);
-                newpsf.vec() = S * (*psf)[k].vec();
+                if (newtrans) {
+                    S.reset(new DMatrix(newpsfsize,psfsize));
+                    CalculateGTransform(_gamma,newpsforder,psforder,*S);
+                }
+                newpsf.vec() = (*S) * (*psf)[k].vec();
                 setnew = true;
                 xdbg<<"newpsf = "<<newpsf<<std::endl;
             }
             if (real(_mu) != 0.) {
                 if (setnew) {
-                    DMatrix D(newpsfsize,newpsfsize);
-                    CalculateMuTransform(real(_mu),newpsforder,D);
-                    newpsf.vec() = D * newpsf.vec();
+                    if (newtrans) {
+                        D.reset(new DMatrix(newpsfsize,newpsfsize));
+                        CalculateMuTransform(real(_mu),newpsforder,*D);
+                    }
+                    newpsf.vec() = (*D) * newpsf.vec();
                 } else {
-                    DMatrix D(newpsfsize,psfsize);
-                    CalculateMuTransform(real(_mu),newpsforder,psforder,D);
-                    newpsf.vec() = D * (*psf)[k].vec();
+                    if (newtrans) {
+                        D.reset(new DMatrix(newpsfsize,psfsize));
+                        CalculateMuTransform(
+                            real(_mu),newpsforder,psforder,*D);
+                    }
+                    newpsf.vec() = (*D) * (*psf)[k].vec();
                     setnew = true;
                 }
                 newpsf.vec() *= exp(2.*real(_mu));
@@ -321,21 +453,26 @@ bool Ellipse::doMeasureShapelet(
             }
             if (imag(_mu) != 0.) {
                 if (setnew) {
+                    if (newtrans) {
 #ifdef USE_TMV
-                    DBandMatrix R(newpsfsize,newpsfsize,1,1);
+                        R.reset(new DBandMatrix(newpsfsize,newpsfsize,1,1));
 #else
-                    DBandMatrix R(newpsfsize,newpsfsize);
+                        R.reset(new DBandMatrix(newpsfsize,newpsfsize));
 #endif
-                    CalculateThetaTransform(imag(_mu),newpsforder,R);
-                    newpsf.vec() = R * newpsf.vec();
+                        CalculateThetaTransform(imag(_mu),newpsforder,*R);
+                    }
+                    newpsf.vec() = (*R) * newpsf.vec();
                 } else {
+                    if (newtrans) {
 #ifdef USE_TMV
-                    DBandMatrix R(newpsfsize,psfsize,1,1);
+                        R.reset(new DBandMatrix(newpsfsize,psfsize,1,1));
 #else
-                    DBandMatrix R(newpsfsize,psfsize);
+                        R.reset(new DBandMatrix(newpsfsize,psfsize));
 #endif
-                    CalculateThetaTransform(imag(_mu),newpsforder,psforder,R);
-                    newpsf.vec() = R * (*psf)[k].vec();
+                        CalculateThetaTransform(
+                            imag(_mu),newpsforder,psforder,*R);
+                    }
+                    newpsf.vec() = (*R) * (*psf)[k].vec();
                     setnew = true;
                 }
                 xdbg<<"newpsf => "<<newpsf<<std::endl;
@@ -351,12 +488,21 @@ bool Ellipse::doMeasureShapelet(
             nx = n+npix;
             DMatrix A1(npix,bsize2);
             DVectorView W1 = W.TMV_subVector(n,nx);
-            MakePsi(A1,Z.TMV_subVector(n,nx),order2,&W1);
+            if (inc) {
+                const double sigma_obs = 
+                    sqrt(pow(sigma,2)+pow(psfsigma,2));
+                inc->makePsi(
+                    k,A1,Zr.TMV_subVector(n,nx),Zi.TMV_subVector(n,nx),
+                    order2,W1,_cen,mm/sigma_obs,-mm*_gamma/sigma_obs);
+            } else {
+                MakePsi(A1,Zr.TMV_subVector(n,nx),Zi.TMV_subVector(n,nx),
+                        order2,&W1);
+            }
             TMV_rowRange(A,n,nx) = A1 * C;
         }
     } else {
         DVectorView W1 = TMV_view(W);
-        MakePsi(A,TMV_vview(Z),order,&W1);
+        MakePsi(A,TMV_vview(Zr),TMV_vview(Zi),order,&W1);
     }
     const double MAX_CONDITION = 1.e8;
 
@@ -450,6 +596,17 @@ bool Ellipse::doMeasureShapelet(
     return true;
 }
 
+template bool Ellipse::doMeasureShapelet(
+    const std::vector<PixelList>& pix,
+    const std::vector<BVec>* psf, BVec& b,
+    int order, int order2, int maxm, DMatrix* bCov,
+    IncrementalPsi* inc) const;
+template bool Ellipse::doMeasureShapelet(
+    const std::vector<PixelColumns>& pix,
+    const std::vector<BVec>* psf, BVec& b,
+    int order, int order2, int maxm, DMatrix* bCov,
+    IncrementalPsi* inc) const;
+
 bool Ellipse::doAltMeasureShapelet(
     const std::vector<PixelList>& pix,
     const std::vector<BVec>* psf, BVec& b, int order, int order2,
@@ -624,6 +781,17 @@ bool Ellipse::measureShapelet(
     int order, int order2, int maxm, DMatrix* bCov) const
 { return doMeasureShapelet(pix,0,b,order,order2,maxm,bCov); }
 
+bool Ellipse::measureShapelet(
+    const std::vector<PixelColumns>& pix,
+    const std::vector<BVec>& psf, BVec& b,
+    int order, int order2, int maxm, DMatrix* bCov) const
+{ return doMeasureShapelet(pix,&psf,b,order,order2,maxm,bCov); }
+
+bool Ellipse::measureShapelet(
+    const std::vector<PixelColumns>& pix, BVec& b,
+    int order, int order2, int maxm, DMatrix* bCov) const
+{ return doMeasureShapelet(pix,0,b,order,order2,maxm,bCov); }
+
 bool Ellipse::altMeasureShapelet(
     const std::vector<PixelList>& pix,
     const std::vector<BVec>& psf, BVec& b, int order, int order2,
@@ -4,11 +4,63 @@
 #include <complex>
 #include <vector>
 #include <ostream>
+#include "boost/shared_ptr.hpp"
 #include "MyMatrix.h"
 #include "dbg.h"
 #include "Pixel.h"
 #include "BVec.h"
 
+// When the same pixels are measured repeatedly in frames that differ
+// only slightly (as in the iterations of the shear measurement), the
+// psi matrix for each exposure can be updated from the one made for an
+// earlier frame rather than being rebuilt from scratch.  See UpdatePsi
+// in PsiHelper.h.
+// The update is used when the change of frame (in units of sigma) is at
+// most max_step.  Otherwise, the psi matrix is rebuilt, and the new frame
+// becomes the base for later updates.  Updates are always made from the
+// base frame, so the errors don't accumulate.
+// The frame is given as the transformation to the shapelet coordinates:
+//   z' = p (z-cen) + q (z-cen)*
+// The same IncrementalPsi should only be used for one set of pixels.
+// Call clear() before using it for different ones.
+class IncrementalPsi
+{
+public :
+
+    IncrementalPsi(double max_step) :
+        _max_step(max_step), _nupdates(0), _nrebuilds(0) {}
+
+    void clear() { _base.clear(); }
+
+    // Make the psi matrix for exposure k.
+    // zr, zi are the positions in the frame given by cen, p, q, and
+    // coeff is the coefficient for each row, as for MakePsi.
+    void makePsi(
+        int k, DMatrix& psi, const DVectorView& zr, const DVectorView& zi,
+        int order, const DVectorView& coeff,
+        std::complex<double> cen, std::complex<double> p, 
+        std::complex<double> q);
+
+    long getNUpdates() const { return _nupdates; }
+    long getNRebuilds() const { return _nrebuilds; }
+
+private :
+
+    struct Base
+    {
+        Base() : order(-1), npix(0) {}
+        int order;
+        int npix;
+        std::complex<double> cen, p, q;
+        boost::shared_ptr<DMatrix> psi;
+    };
+
+    double _max_step;
+    std::vector<Base> _base;
+    long _nupdates;
+    long _nrebuilds;
+};
+
 class Ellipse 
 {
 
@@ -17,26 +69,27 @@ public :
     Ellipse() :
         _cen(0.), _gamma(0.), _mu(0.),
         _fixcen(false), _fixgamma(false), _fixmu(false), 
-        _dotimings(false) {}
+        _dotimings(false), _incremental_psi(0) {}
 
     Ellipse(std::complex<double> cen, std::complex<double> gamma,
             std::complex<double> mu) :
         _cen(cen), _gamma(gamma), _mu(mu), 
         _fixcen(false), _fixgamma(false), _fixmu(false), 
-        _dotimings(false) {}
+        _dotimings(false), _incremental_psi(0) {}
 
     Ellipse(double vals[]) :
         _cen(vals[0],vals[1]), _gamma(vals[2],vals[3]), _mu(vals[4]),
         _fixcen(false), _fixgamma(false), _fixmu(false),
-        _dotimings(false) {}
+        _dotimings(false), _incremental_psi(0) {}
 
-    // Copy constructor and op= do not copy fixed-ness.  
+    // Copy constructor and op= do not copy fixed-ness (or the 
+    // incremental psi setting).  
     // They only copy the tranformation itself.
     Ellipse(const Ellipse& e2) :
         _cen(e2.getCen()), _gamma(e2.getGamma()),
         _mu(e2.getMu(),e2.getTheta()),
         _fixcen(false), _fixgamma(false), _fixmu(false),
-        _dotimings(false) {}
+        _dotimings(false), _incremental_psi(0) {}
 
     Ellipse& operator=(const Ellipse& e2)
     { 
@@ -68,6 +121,21 @@ public :
         double sigma, long& flag, double thresh, DSmallMatrix22* cov=0,
         const Ellipse* ell_meas=0);
 
+    // The same, but using column-oriented copies of the pixel lists.
+    // This is faster when the same pixels are measured several times,
+    // since the PixelColumns only need to be built once.
+    bool measure(
+        const std::vector<PixelColumns>& pix, 
+        int order, int order2, int maxm,
+        double sigma, long& flag, double thresh, DSmallMatrix22* cov=0,
+        const Ellipse* ell_meas=0);
+    bool measure(
+        const std::vector<PixelColumns>& pix, 
+        const std::vector<BVec>& psf,
+        int order, int order2, int maxm,
+        double sigma, long& flag, double thresh, DSmallMatrix22* cov=0,
+        const Ellipse* ell_meas=0);
+
     // Given a measured shapelet vector, find the ellipse transformation
     // in which this shapelet vector would be observed to be round.
     bool findRoundFrame(
@@ -107,6 +175,13 @@ public :
         const std::vector<PixelList>& pix, 
         const std::vector<BVec>& psf, BVec& bret,
         int order, int order2, int maxm, DMatrix* bcov=0) const;
+    bool measureShapelet(
+        const std::vector<PixelColumns>& pix, BVec& bret,
+        int order, int order2, int maxm, DMatrix* bcov=0) const;
+    bool measureShapelet(
+        const std::vector<PixelColumns>& pix, 
+        const std::vector<BVec>& psf, BVec& bret,
+        int order, int order2, int maxm, DMatrix* bcov=0) const;
 
     // An alternative measurement that uses the formula:
     // <psi_pq | psi_st> = delta_ps delta_qt
@@ -162,21 +237,32 @@ public :
 
     void doTimings() { _dotimings = true; }
 
+    // Use inc to make the psi matrices for the psf-deconvolved 
+    // measurements.  The default (0) is to rebuild them each time.
+    // inc is not owned by the Ellipse.
+    void setIncrementalPsi(IncrementalPsi* inc) { _incremental_psi = inc; }
+
     void write(std::ostream& os) const
     { os << _cen<<" "<<_gamma<<" "<<_mu; }
 
 private :
 
+    // These are templates so they can work with either PixelList
+    // or PixelColumns.  They are instantiated for both in Ellipse.cpp
+    // and Ellipse_meas.cpp.
+    template <class PixList>
     bool doMeasure(
-        const std::vector<PixelList>& pix, 
+        const std::vector<PixList>& pix, 
         const std::vector<BVec>* psf, int order, int order2, int maxm,
         double sigma, long& flag, double thresh, DSmallMatrix22* cov=0,
         const Ellipse* ell_meas=0);
 
+    template <class PixList>
     bool doMeasureShapelet(
-        const std::vector<PixelList>& pix, 
+        const std::vector<PixList>& pix, 
         const std::vector<BVec>* psf, BVec& bret,
-        int order, int order2, int maxm, DMatrix* bcov=0) const;
+        int order, int order2, int maxm, DMatrix* bcov=0,
+        IncrementalPsi* inc=0) const;
 
     bool doAltMeasureShapelet(
         const std::vector<PixelList>& pix, 
@@ -191,6 +277,8 @@ private :
 
     bool _dotimings;
 
+    IncrementalPsi* _incremental_psi;
+
 };
 
 inline std::ostream& operator<<(std::ostream& os, const Ellipse& s)
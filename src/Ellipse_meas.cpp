@@ -8,8 +8,9 @@
 
 const double MAX_GAMMA_PRIOR = 0.7;
 
+template <class PixList>
 bool Ellipse::doMeasure(
-    const std::vector<PixelList>& pix,
+    const std::vector<PixList>& pix,
     const std::vector<BVec>* psf,
     int galorder, int galorder2, int maxm,
     double sigma, long& flag, double thresh, DSmallMatrix22* cov, 
@@ -42,7 +43,8 @@ bool Ellipse::doMeasure(
         bcov.reset(new DMatrix(int(b.size()),int(b.size())));
 
     if (!ell_meas->doMeasureShapelet(
-            pix,psf,b,galorder,galorder2,maxm,bcov.get())) {
+            pix,psf,b,galorder,galorder2,maxm,bcov.get(),
+            _incremental_psi)) {
         xdbg<<"Could not measure a shapelet vector.\n";
         return false;
     }
@@ -55,6 +57,19 @@ bool Ellipse::doMeasure(
     return findRoundFrame(b,psf,*ell_meas,galorder2,thresh,flag,bcov.get(),cov);
 }
 
+template bool Ellipse::doMeasure(
+    const std::vector<PixelList>& pix,
+    const std::vector<BVec>* psf,
+    int galorder, int galorder2, int maxm,
+    double sigma, long& flag, double thresh, DSmallMatrix22* cov, 
+    const Ellipse* ell_meas);
+template bool Ellipse::doMeasure(
+    const std::vector<PixelColumns>& pix,
+    const std::vector<BVec>* psf,
+    int galorder, int galorder2, int maxm,
+    double sigma, long& flag, double thresh, DSmallMatrix22* cov, 
+    const Ellipse* ell_meas);
+
 static double CalculateLikelihood(
     const std::complex<double>& gamma,
     const Ellipse& ell_meas, const BVec& b, const DMatrix& bcov)
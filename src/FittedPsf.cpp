@@ -1,5 +1,6 @@
 
 #include <valarray>
+#include <algorithm>
 #include <fstream>
 #include <CCfits/CCfits>
 
@@ -25,10 +26,10 @@ static DVector definePXY(
 }
 
 #ifdef USE_TMV
-static void setPRow(
+void FittedPsf::setPRow(
     int fitorder, Position pos, const Bounds& bounds, DVectorView prow)
 #else
-static void setPRow(
+void FittedPsf::setPRow(
     int fitorder, Position pos, const Bounds& bounds, DVector& prow)
 #endif
 {
@@ -52,7 +53,9 @@ FittedPsf::FittedPsf(
     PsfCatalog& psfcat, const ConfigFile& params, PsfLog& log) :
     _params(params), _psforder(_params.read<int>("psf_order")),
     _fitorder(_params.read<int>("fitpsf_order")),
-    _fitsize((_fitorder+1)*(_fitorder+2)/2)
+    _fitsize((_fitorder+1)*(_fitorder+2)/2),
+    _grid_nx(0), _grid_ny(0), _grid_dx(0.), _grid_dy(0.),
+    _grid_nearest(false), _grid_error(0.)
 {
     xdbg<<"FittedPSF constructor\n";
     // Do a polynomial fit of the psf shapelet vectors
@@ -81,251 +84,12 @@ FittedPsf::FittedPsf(
         log);
 }
 
-void FittedPsf::calculate(
-    const std::vector<Position>& pos,
-    const std::vector<BVec>& psf,
-    const std::vector<double>& nu,
-    std::vector<long>& flags, 
-    PsfLog& log)
-{
-    const int nstars = pos.size();
-    const int psfsize = (_psforder+1)*(_psforder+2)/2;
-    const double nsigma_clip = _params.read("fitpsf_nsigma_outlier",3);
-
-    // This is an empirical fit to the chisq level that corresponds to 
-    // a 3-sigma outlier for more than 1 dimension.
-    // I calculated the values up to n=100 and for n>30, they form a pretty
-    // good approximation to a straight line.
-    // This is almost certainly wrong for nsigma_clip != 3, so if we start 
-    // choosing other values for nsigma_clip, it might be worth doing this 
-    // right.
-    // That means calculating the 1-d critical value for the given nSigma.
-    // e.g. nSigma = 3 -> alpha = P(chisq > 9) = 0.0027.
-    // Then calculate the critical value of chisq for that alpha with 
-    // the full degrees of freedom = psfsize
-    const double chisq_level = 0.14*psfsize + 2.13;
-
-    const double outlier_thresh = nsigma_clip * nsigma_clip * chisq_level;
-    dbg<<"outlier_thresh = "<<outlier_thresh<<std::endl;
-
-    int ngood_psf, noutliers, dof;
-    double chisq;
-    do {
-
-        // Calculate the average psf vector
-        _avepsf.reset(new DVector(psfsize));
-        Assert(psfsize == int(_avepsf->size()));
-        _avepsf->setZero();
-        ngood_psf = 0;
-        for(int n=0;n<nstars;++n) if ( flags[n]==0 ) {
-            Assert(psf[n].getSigma() == _sigma);
-            *_avepsf += psf[n].vec();
-            ++ngood_psf;
-        }
-        xdbg<<"ngood_psf = "<<ngood_psf<<std::endl;
-        if (ngood_psf == 0) {
-            dbg<<"ngoodpsf = 0 in FittedPsf::calculate\n";
-            throw ProcessingException("No good stars found for interpolation.");
-        }
-        *_avepsf /= double(ngood_psf);
-        xdbg<<"_avepsf = "<<*_avepsf<<std::endl;
-
-        // Rotate the vectors into their eigen directions.
-        // The matrix V is stored to let us get back to the original basis.
-        DMatrix mM(ngood_psf,psfsize);
-        DDiagMatrix inverseSigma(ngood_psf);
-        int i=0;
-        for(int n=0;n<nstars;++n) if ( flags[n]==0 ) {
-            Assert(int(psf[n].size()) == psfsize);
-            Assert(i < ngood_psf);
-            mM.row(i) = psf[n].vec() - *_avepsf;
-            inverseSigma(i) = nu[n];
-            _bounds += pos[n];
-            ++i;
-        }
-        Assert(i == ngood_psf);
-        xdbg<<"bounds = "<<_bounds<<std::endl;
-        xxdbg<<"mM = "<<mM<<std::endl;
-        xdbg<<"inverseSigma = "<<inverseSigma EIGEN_asDiag() .TMV_diag()<<std::endl;
-        mM = inverseSigma EIGEN_asDiag() * mM;
-        xxdbg<<"mM => "<<mM<<std::endl;
-
-        int npca_tot = std::min(ngood_psf,psfsize);
-        xdbg<<"npca_tot = "<<npca_tot<<std::endl;
-        DDiagMatrix mS(npca_tot);
-#ifdef USE_TMV
-        DMatrixView mU = mM.colRange(0,npca_tot);
-        _mV.reset(new tmv::Matrix<double,tmv::RowMajor>(npca_tot,psfsize));
-        xxdbg<<"mU = "<<mU<<std::endl;
-        if (ngood_psf > psfsize) {
-            xdbg<<"Regular nGood > psfSize\n";
-            SV_Decompose(mU.view(),mS.view(),_mV->view(),true);
-        } else {
-            xdbg<<"Transpose version nGood <= psfSize\n";
-            *_mV = mM;
-            SV_Decompose(_mV->transpose(),mS.view(),mU.transpose());
-        }
-        xdbg<<"In FittedPSF: SVD S = "<<mS.diag()<<std::endl;
-        xxdbg<<"U => "<<mU<<std::endl;
-        xxdbg<<"V => "<<*_mV<<std::endl;
-#else
-        DMatrix mU(mM.TMV_colsize(),npca_tot);
-        _mV_transpose.reset(new DMatrix(psfsize,npca_tot));
-        if (ngood_psf > psfsize) {
-            Eigen::SVD<DMatrix> svd = TMV_colRange(mM,0,npca_tot).svd();
-            mU = svd.matrixU();
-            mS = svd.singularValues();
-            *_mV_transpose = svd.matrixV();
-        } else {
-            Eigen::SVD<Eigen::Transpose<DMatrix>::PlainMatrixType > svd = mM.transpose().svd();
-            mU = svd.matrixV();
-            mS = svd.singularValues();
-            *_mV_transpose = svd.matrixU();
-        }
-        xdbg<<"In FittedPSF: SVD S = "<<EIGEN_Transpose(mS)<<std::endl;
-#endif
-        if (_params.keyExists("fitpsf_npca")) {
-            _npca = _params["fitpsf_npca"];
-            dbg<<"npca = "<<_npca<<" from parameter file\n";
-        } else {
-            double thresh = mS(0);
-            if (_params.keyExists("fitpsf_pca_thresh")) 
-                thresh *= double(_params["fitpsf_pca_thresh"]);
-            else thresh *= std::numeric_limits<double>::epsilon();
-            dbg<<"thresh = "<<thresh<<std::endl;
-            for(_npca=1;_npca<int(mS.size());++_npca) {
-                if (mS(_npca) < thresh) break;
-            }
-            dbg<<"npca = "<<_npca<<std::endl;
-        }
-#ifdef USE_TMV
-        mU.colRange(0,_npca) *= mS.subDiagMatrix(0,_npca);
-#else
-        TMV_colRange(mU,0,_npca) *= mS.TMV_subVector(0,_npca).asDiagonal();
-#endif
-        xdbg<<"After U *= S\n";
-        // U S = M(orig) * Vt
-
-        while (ngood_psf <= _fitsize && _fitsize > 1) {
-            --_fitorder;
-            _fitsize = (_fitorder+1)*(_fitorder+2)/2;
-            dbg<<"Too few good stars... reducing order of fit to "<<
-                _fitorder<<std::endl;
-        }
-        DMatrix mP(ngood_psf,_fitsize);
-        mP.setZero();
-        i=0;
-        for(int n=0;n<nstars;++n) if ( flags[n]==0 ) {
-            xdbg<<"n = "<<n<<" / "<<nstars<<std::endl;
-#ifdef USE_TMV
-            setPRow(_fitorder,pos[n],_bounds,mP.row(i));
-#else
-            DVector mProwi(mP.TMV_rowsize());
-            setPRow(_fitorder,pos[n],_bounds,mProwi);
-            mP.row(i) = mProwi.transpose();
-#endif
-            ++i;
-        }
-        Assert(i == ngood_psf);
-        mP = inverseSigma EIGEN_asDiag() * mP;
-        xdbg<<"after mP = sigma * mP\n";
-
-#ifdef USE_TMV
-        _f.reset(new DMatrix(TMV_colRange(mU,0,_npca)/mP));
-#else
-        _f.reset(new DMatrix(_fitsize,_npca));
-        mP.qr().solve(TMV_colRange(mU,0,_npca),&(*_f));
-#endif
-        xdbg<<"Done making FittedPSF\n";
-
-        //
-        // Remove outliers from the fit using the empirical covariance matrix
-        // of the data with respect to the fitted values.
-        //
-        xdbg<<"Checking for outliers:\n";
-
-        // Calculate the covariance matrix
-        DMatrix cov(psfsize,psfsize);
-        cov.setZero();
-        for(int n=0;n<nstars;++n) if ( flags[n]==0 ) {
-            const BVec& data = psf[n];
-            DVector fit(psfsize);
-            interpolateVector(pos[n],TMV_vview(fit));
-            DVector diff = data.vec() - fit;
-#ifdef USE_TMV
-            cov += diff ^ diff;
-#else
-            cov += diff * diff.transpose();
-#endif
-        }
-
-        chisq = (mP * *_f - TMV_colRange(mU,0,_npca)).TMV_normSq();
-        dbg<<"chisq calculation #1 = "<<chisq<<std::endl;
-        dof = ngood_psf - _fitsize;
-
-        if (dof > 0) { 
-            cov /= double(dof);
-        }
-#ifdef USE_TMV
-        cov.divideUsing(tmv::SV);
-        cov.saveDiv();
-        cov.setDiv();
-        dbg<<"cov S = "<<cov.svd().getS().diag()<<std::endl;
-#else
-        Eigen::SVD<DMatrix> cov_svd = cov.svd();
-        dbg<<"cov S = "<<EIGEN_Transpose(cov_svd.singularValues())<<std::endl;
-
-#endif
-
-        // Clip out 3 sigma outliers:
-        noutliers = 0;
-        chisq = 0;
-        for(int n=0;n<nstars;++n) if ( flags[n]==0 ) {
-            const BVec& data = psf[n];
-            DVector fit(psfsize);
-            interpolateVector(pos[n],TMV_vview(fit));
-            DVector diff = data.vec() - fit;
-#ifdef USE_TMV
-            double dev = diff * cov.inverse() * diff;
-#else
-            DVector temp(psfsize);
-            cov_svd.solve(diff,&temp);
-            double dev = (diff.transpose() * temp)(0,0);
-#endif
-            chisq += dev;
-            if (dev > outlier_thresh) {
-                xdbg<<"n = "<<n<<" is an outlier.\n";
-                xdbg<<"data = "<<data.vec()<<std::endl;
-                xdbg<<"fit = "<<fit<<std::endl;
-                xdbg<<"diff = "<<diff<<std::endl;
-#ifdef USE_TMV
-                xdbg<<"diff/cov = "<<diff/cov<<std::endl;
-#else
-                xdbg<<"diff/cov = "<<temp<<std::endl;
-#endif
-                xdbg<<"dev = "<<dev<<std::endl;
-                ++noutliers;
-                flags[n] |= PSF_INTERP_OUTLIER;
-            }
-        }
-        dbg<<"ngoodpsf = "<<ngood_psf<<std::endl;
-        dbg<<"noutliers = "<<noutliers<<std::endl;
-        dbg<<"chisq calculation #2 = "<<chisq<<std::endl;
-
-    } while (noutliers > 0);
-
-    log._noutliers = noutliers;
-    log._nfit = ngood_psf;
-    log._npc = _npca;
-    log._chisq_fit = chisq;
-    log._dof_fit = dof;
-
-}
-
 FittedPsf::FittedPsf(const ConfigFile& params) : 
     _params(params), _psforder(_params.read<int>("psf_order")),
     _fitorder(_params.read<int>("fitpsf_order")),
-    _fitsize((_fitorder+1)*(_fitorder+2)/2)
+    _fitsize((_fitorder+1)*(_fitorder+2)/2),
+    _grid_nx(0), _grid_ny(0), _grid_dx(0.), _grid_dy(0.),
+    _grid_nearest(false), _grid_error(0.)
 { }
 
 void FittedPsf::writeAscii(std::string file) const
@@ -459,6 +223,21 @@ void FittedPsf::read(std::string file)
             "Error reading from "+file+" -- caught unknown error");
     }
     dbg<<"Done Read FittedPSF\n";
+
+    // Optionally precompute the psf on a grid.
+    double grid_spacing = _params.read("fitpsf_grid_spacing",0.);
+    if (grid_spacing > 0.) {
+        std::string method = _params.read<std::string>(
+            "fitpsf_grid_method","BILINEAR");
+        Assert(method == "BILINEAR" || method == "NEAREST");
+        double error = makeGrid(grid_spacing, method == "NEAREST");
+        double max_error = _params.read("fitpsf_grid_max_error",0.);
+        if (max_error > 0. && error > max_error) {
+            dbg<<"Grid error "<<error<<" > fitpsf_grid_max_error = "<<
+                max_error<<".  Using exact interpolation.\n";
+            clearGrid();
+        }
+    }
 }
 
 void FittedPsf::writeFits(std::string file) const
@@ -754,6 +533,12 @@ double FittedPsf::interpolateSingleElement(Position pos, int i) const
 }
 
 void FittedPsf::interpolateVector(Position pos, DVectorView b) const
+{
+    if (_grid.get()) interpolateGrid(pos,b);
+    else interpolateExact(pos,b);
+}
+
+void FittedPsf::interpolateExact(Position pos, DVectorView b) const
 {
     DVector P(_fitsize);
 #ifdef USE_TMV
@@ -768,6 +553,153 @@ void FittedPsf::interpolateVector(Position pos, DVectorView b) const
     b += *_avepsf;
 }
 
+void FittedPsf::interpolateMany(
+    const std::vector<Position>& pos, std::vector<BVec>& b) const
+{
+    Assert(_avepsf.get());
+    const int n = pos.size();
+    b.clear();
+    if (n == 0) return;
+    b.reserve(n);
+
+    if (_grid.get()) {
+        for(int k=0;k<n;++k) {
+            b.push_back(BVec(_psforder,_sigma));
+            interpolateGrid(pos[k],TMV_vview(b[k].vec()));
+        }
+        return;
+    }
+
+    // Each row of P has the polynomial terms for one position.
+    DMatrix P(n,_fitsize);
+#ifdef USE_TMV
+    for(int k=0;k<n;++k) setPRow(_fitorder,pos[k],_bounds,P.row(k));
+    DMatrix B1 = P * (*_f);
+    DMatrix B = B1 * _mV->rowRange(0,_npca);
+#else
+    DVector prow(_fitsize);
+    for(int k=0;k<n;++k) {
+        setPRow(_fitorder,pos[k],_bounds,prow);
+        P.row(k) = prow.transpose();
+    }
+    DMatrix B1 = P * (*_f);
+    DMatrix B = B1 * TMV_colRange(*_mV_transpose,0,_npca).transpose();
+#endif
+
+    for(int k=0;k<n;++k) {
+        b.push_back(BVec(_psforder,_sigma));
+#ifdef USE_TMV
+        b[k].vec() = B.row(k);
+#else
+        b[k].vec() = B.row(k).transpose();
+#endif
+        b[k].vec() += *_avepsf;
+    }
+}
+
+double FittedPsf::makeGrid(double spacing, bool nearest)
+{
+    Assert(spacing > 0.);
+    Assert(_avepsf.get());
+    _grid.reset();
+
+    const double xmin = _bounds.getXMin();
+    const double ymin = _bounds.getYMin();
+    const double xrange = _bounds.getXMax() - xmin;
+    const double yrange = _bounds.getYMax() - ymin;
+    // The grid covers the bounds, with the spacing adjusted to
+    // fit an integer number of cells.
+    const int ncellx = std::max(1,int(ceil(xrange / spacing)));
+    const int ncelly = std::max(1,int(ceil(yrange / spacing)));
+    const int nx = ncellx + 1;
+    const int ny = ncelly + 1;
+    const double dx = xrange / ncellx;
+    const double dy = yrange / ncelly;
+    const int psfsize = _avepsf->size();
+    dbg<<"Making psf grid: "<<nx<<" x "<<ny<<", dx,dy = "<<
+        dx<<','<<dy<<", nearest = "<<nearest<<std::endl;
+
+    std::auto_ptr<DMatrix> grid(new DMatrix(nx*ny,psfsize));
+    DVector b(psfsize);
+    for(int iy=0;iy<ny;++iy) for(int ix=0;ix<nx;++ix) {
+        Position pos(xmin+ix*dx, ymin+iy*dy);
+        interpolateExact(pos,TMV_vview(b));
+#ifdef USE_TMV
+        grid->row(iy*nx+ix) = b;
+#else
+        grid->row(iy*nx+ix) = b.transpose();
+#endif
+    }
+    _grid_nx = nx;
+    _grid_ny = ny;
+    _grid_dx = dx;
+    _grid_dy = dy;
+    _grid_nearest = nearest;
+    _grid = grid;
+
+    // Estimate the maximum error by comparing to the exact values at the
+    // points farthest from the grid points: the cell centers and the 
+    // midpoints of the cell edges.  
+    DVector exact(psfsize);
+    double max_error = 0.;
+    for(int iy=0;iy<2*ncelly;++iy) for(int ix=0;ix<2*ncellx;++ix) {
+        if (ix%2 == 0 && iy%2 == 0) continue;
+        // For nearest, the worst spots are just inside the cell corners,
+        // but the centers give a decent estimate.
+        Position pos(xmin+ix*dx/2., ymin+iy*dy/2.);
+        interpolateExact(pos,TMV_vview(exact));
+        interpolateGrid(pos,TMV_vview(b));
+        double error = (b-exact).TMV_normInf();
+        if (error > max_error) max_error = error;
+    }
+    _grid_error = max_error;
+    dbg<<"psf grid max error = "<<max_error<<
+        " (relative to b00 = "<<max_error/std::abs((*_avepsf)(0))<<")\n";
+    return max_error;
+}
+
+void FittedPsf::interpolateGrid(Position pos, DVectorView b) const
+{
+    Assert(_grid.get());
+    // Position in units of the grid spacing.
+    double x = (pos.getX() - _bounds.getXMin()) / _grid_dx;
+    double y = (pos.getY() - _bounds.getYMin()) / _grid_dy;
+    // Clip to the grid, so points on the edge of the bounds 
+    // (or slightly past them) are ok.
+    if (x < 0.) x = 0.;
+    if (y < 0.) y = 0.;
+    if (x > _grid_nx-1) x = _grid_nx-1;
+    if (y > _grid_ny-1) y = _grid_ny-1;
+
+    if (_grid_nearest) {
+        int ix = int(floor(x+0.5));
+        int iy = int(floor(y+0.5));
+#ifdef USE_TMV
+        b = _grid->row(iy*_grid_nx+ix);
+#else
+        b = _grid->row(iy*_grid_nx+ix).transpose();
+#endif
+        return;
+    }
+
+    int ix = std::min(int(floor(x)),_grid_nx-2);
+    int iy = std::min(int(floor(y)),_grid_ny-2);
+    const double fx = x - ix;
+    const double fy = y - iy;
+    const int k = iy*_grid_nx+ix;
+#ifdef USE_TMV
+    b = (1.-fx)*(1.-fy) * _grid->row(k);
+    b += fx*(1.-fy) * _grid->row(k+1);
+    b += (1.-fx)*fy * _grid->row(k+_grid_nx);
+    b += fx*fy * _grid->row(k+_grid_nx+1);
+#else
+    b = (1.-fx)*(1.-fy) * _grid->row(k).transpose();
+    b += fx*(1.-fy) * _grid->row(k+1).transpose();
+    b += (1.-fx)*fy * _grid->row(k+_grid_nx).transpose();
+    b += fx*fy * _grid->row(k+_grid_nx+1).transpose();
+#endif
+}
+
 BVec FittedPsf::getMean() const
 { return BVec(_psforder,_sigma,*_avepsf); }
 
@@ -67,6 +67,14 @@ public :
 
     double interpolateSingleElement(Position pos, int i) const;
 
+    // Interpolate the psf at many positions at once.  This is much 
+    // faster than calling interpolate for each one, since the 
+    // polynomial terms for all the positions are multiplied by the
+    // fitted coefficients with a single matrix product.
+    // On output, b has one element for each position.
+    void interpolateMany(
+        const std::vector<Position>& pos, std::vector<BVec>& b) const;
+
     // This next construct with FittedPsfAtXY allows you to write:
     // b = psf(pos);
     // instead of:
@@ -77,9 +85,32 @@ public :
 
     BVec getMean() const;
 
+    // Precompute the psf on a grid of points spaced by spacing pixels
+    // over the bounds, and use that for all later interpolations.
+    // If nearest is true, the value at the nearest grid point is used.
+    // Otherwise, the values are bilinearly interpolated between the 
+    // grid points.  
+    // Returns an estimate of the maximum error in any psf coefficient
+    // relative to the exact interpolation.
+    double makeGrid(double spacing, bool nearest=false);
+    void clearGrid() { _grid.reset(); }
+    bool hasGrid() const { return _grid.get(); }
+    double getGridError() const { return _grid_error; }
+
 private :
 
+    // Set prow to the polynomial terms at pos.
+#ifdef USE_TMV
+    static void setPRow(
+        int fitorder, Position pos, const Bounds& bounds, DVectorView prow);
+#else
+    static void setPRow(
+        int fitorder, Position pos, const Bounds& bounds, DVector& prow);
+#endif
+
     void interpolateVector(Position pos, DVectorView b) const;
+    void interpolateExact(Position pos, DVectorView b) const;
+    void interpolateGrid(Position pos, DVectorView b) const;
 
     const ConfigFile& _params;
 
@@ -96,6 +127,14 @@ private :
     std::auto_ptr<DMatrix> _mV_transpose;
 #endif
     std::auto_ptr<DMatrix> _f;
+
+    // The optional grid of psf values.  Each row is the psf at one
+    // grid point, with ix varying fastest.
+    std::auto_ptr<DMatrix> _grid;
+    int _grid_nx, _grid_ny;
+    double _grid_dx, _grid_dy;
+    bool _grid_nearest;
+    double _grid_error;
 };
 
 class FittedPsfAtXY : public AssignableToBVec
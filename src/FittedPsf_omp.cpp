@@ -0,0 +1,300 @@
+
+#include <algorithm>
+#include <limits>
+
+#include "dbg.h"
+#include "FittedPsf.h"
+#include "Params.h"
+
+void FittedPsf::calculate(
+    const std::vector<Position>& pos,
+    const std::vector<BVec>& psf,
+    const std::vector<double>& nu,
+    std::vector<long>& flags,
+    PsfLog& log)
+{
+    const int nstars = pos.size();
+    const int psfsize = (_psforder+1)*(_psforder+2)/2;
+    const double nsigma_clip = _params.read("fitpsf_nsigma_outlier",3);
+
+    // If fitpsf_fast_svd is set, get the principal components from the
+    // small psfsize x psfsize matrix M^T M rather than from M itself.
+    // See below.
+    const bool fast_svd = _params.read("fitpsf_fast_svd",false);
+
+    // Any existing grid would be stale once the fit changes.
+    clearGrid();
+
+    // This is an empirical fit to the chisq level that corresponds to
+    // a 3-sigma outlier for more than 1 dimension.
+    // I calculated the values up to n=100 and for n>30, they form a pretty
+    // good approximation to a straight line.
+    // This is almost certainly wrong for nsigma_clip != 3, so if we start
+    // choosing other values for nsigma_clip, it might be worth doing this
+    // right.
+    // That means calculating the 1-d critical value for the given nSigma.
+    // e.g. nSigma = 3 -> alpha = P(chisq > 9) = 0.0027.
+    // Then calculate the critical value of chisq for that alpha with
+    // the full degrees of freedom = psfsize
+    const double chisq_level = 0.14*psfsize + 2.13;
+
+    const double outlier_thresh = nsigma_clip * nsigma_clip * chisq_level;
+    dbg<<"outlier_thresh = "<<outlier_thresh<<std::endl;
+
+    int ngood_psf, noutliers, dof;
+    double chisq;
+    do {
+
+        // The indices of the stars still being used
+        std::vector<int> good;
+        for(int n=0;n<nstars;++n) if ( flags[n]==0 ) good.push_back(n);
+        ngood_psf = good.size();
+        xdbg<<"ngood_psf = "<<ngood_psf<<std::endl;
+        if (ngood_psf == 0) {
+            dbg<<"ngoodpsf = 0 in FittedPsf::calculate\n";
+            throw ProcessingException("No good stars found for interpolation.");
+        }
+
+        // Calculate the average psf vector
+        _avepsf.reset(new DVector(psfsize));
+        Assert(psfsize == int(_avepsf->size()));
+        _avepsf->setZero();
+        for(int k=0;k<ngood_psf;++k) {
+            const int n = good[k];
+            Assert(psf[n].getSigma() == _sigma);
+            *_avepsf += psf[n].vec();
+        }
+        *_avepsf /= double(ngood_psf);
+        xdbg<<"_avepsf = "<<*_avepsf<<std::endl;
+
+        // Rotate the vectors into their eigen directions.
+        // The matrix V is stored to let us get back to the original basis.
+        DMatrix mM(ngood_psf,psfsize);
+        DDiagMatrix inverseSigma(ngood_psf);
+        for(int k=0;k<ngood_psf;++k) {
+            const int n = good[k];
+            Assert(int(psf[n].size()) == psfsize);
+#ifdef USE_TMV
+            mM.row(k) = psf[n].vec() - *_avepsf;
+#else
+            mM.row(k) = (psf[n].vec() - *_avepsf).transpose();
+#endif
+            inverseSigma(k) = nu[n];
+            _bounds += pos[n];
+        }
+        xdbg<<"bounds = "<<_bounds<<std::endl;
+        xxdbg<<"mM = "<<mM<<std::endl;
+        xdbg<<"inverseSigma = "<<inverseSigma EIGEN_asDiag() .TMV_diag()<<std::endl;
+        mM = inverseSigma EIGEN_asDiag() * mM;
+        xxdbg<<"mM => "<<mM<<std::endl;
+
+        int npca_tot = std::min(ngood_psf,psfsize);
+        xdbg<<"npca_tot = "<<npca_tot<<std::endl;
+        DDiagMatrix mS(npca_tot);
+
+        // With many stars, M is much taller than it is wide, and we only
+        // keep the first npca components anyway.  So rather than the
+        // full SVD of M = U S V^T, we can get S and V from the
+        // decomposition of M^T M = V S^2 V^T, which is only psfsize on
+        // a side, and then we only need the first npca columns of
+        // US = M V.  This loses precision for the components with
+        // S/S(0) < sqrt(epsilon), but those are always dropped anyway.
+        const bool use_gram = fast_svd && ngood_psf > psfsize;
+#ifdef USE_TMV
+        DMatrixView mU = mM.colRange(0,npca_tot);
+        _mV.reset(new tmv::Matrix<double,tmv::RowMajor>(npca_tot,psfsize));
+        if (use_gram) {
+            xdbg<<"Using M^T M for the SVD\n";
+            DMatrix mG = mM.transpose() * mM;
+            DDiagMatrix mS2(psfsize);
+            SV_Decompose(mG.view(),mS2.view(),_mV->view(),false);
+            for(int k=0;k<npca_tot;++k) mS(k) = sqrt(std::max(mS2(k),0.));
+        } else if (ngood_psf > psfsize) {
+            xdbg<<"Regular nGood > psfSize\n";
+            SV_Decompose(mU.view(),mS.view(),_mV->view(),true);
+        } else {
+            xdbg<<"Transpose version nGood <= psfSize\n";
+            *_mV = mM;
+            SV_Decompose(_mV->transpose(),mS.view(),mU.transpose());
+        }
+        xdbg<<"In FittedPSF: SVD S = "<<mS.diag()<<std::endl;
+        xxdbg<<"V => "<<*_mV<<std::endl;
+#else
+        DMatrix mU(mM.TMV_colsize(),npca_tot);
+        _mV_transpose.reset(new DMatrix(psfsize,npca_tot));
+        if (use_gram) {
+            xdbg<<"Using M^T M for the SVD\n";
+            DMatrix mG = mM.transpose() * mM;
+            Eigen::SVD<DMatrix> svd = mG.svd();
+            for(int k=0;k<npca_tot;++k)
+                mS(k) = sqrt(std::max(svd.singularValues()(k),0.));
+            *_mV_transpose = svd.matrixV();
+        } else if (ngood_psf > psfsize) {
+            Eigen::SVD<DMatrix> svd = TMV_colRange(mM,0,npca_tot).svd();
+            mU = svd.matrixU();
+            mS = svd.singularValues();
+            *_mV_transpose = svd.matrixV();
+        } else {
+            Eigen::SVD<Eigen::Transpose<DMatrix>::PlainMatrixType > svd = mM.transpose().svd();
+            mU = svd.matrixV();
+            mS = svd.singularValues();
+            *_mV_transpose = svd.matrixU();
+        }
+        xdbg<<"In FittedPSF: SVD S = "<<EIGEN_Transpose(mS)<<std::endl;
+#endif
+        if (_params.keyExists("fitpsf_npca")) {
+            _npca = _params["fitpsf_npca"];
+            dbg<<"npca = "<<_npca<<" from parameter file\n";
+        } else {
+            double thresh = mS(0);
+            if (_params.keyExists("fitpsf_pca_thresh"))
+                thresh *= double(_params["fitpsf_pca_thresh"]);
+            else thresh *= std::numeric_limits<double>::epsilon();
+            dbg<<"thresh = "<<thresh<<std::endl;
+            for(_npca=1;_npca<int(mS.size());++_npca) {
+                if (mS(_npca) < thresh) break;
+            }
+            dbg<<"npca = "<<_npca<<std::endl;
+        }
+
+        // U S = M(orig) * Vt
+        DMatrix mUS(ngood_psf,_npca);
+        if (use_gram) {
+#ifdef USE_TMV
+            mUS = mM * _mV->rowRange(0,_npca).transpose();
+#else
+            mUS = mM * TMV_colRange(*_mV_transpose,0,_npca);
+#endif
+        } else {
+#ifdef USE_TMV
+            mUS = mU.colRange(0,_npca) * mS.subDiagMatrix(0,_npca);
+#else
+            mUS = TMV_colRange(mU,0,_npca) *
+                mS.TMV_subVector(0,_npca).asDiagonal();
+#endif
+        }
+        xdbg<<"After U *= S\n";
+
+        while (ngood_psf <= _fitsize && _fitsize > 1) {
+            --_fitorder;
+            _fitsize = (_fitorder+1)*(_fitorder+2)/2;
+            dbg<<"Too few good stars... reducing order of fit to "<<
+                _fitorder<<std::endl;
+        }
+        DMatrix mP(ngood_psf,_fitsize);
+        mP.setZero();
+        for(int k=0;k<ngood_psf;++k) {
+            const int n = good[k];
+            xdbg<<"n = "<<n<<" / "<<nstars<<std::endl;
+#ifdef USE_TMV
+            setPRow(_fitorder,pos[n],_bounds,mP.row(k));
+#else
+            DVector mProwi(mP.TMV_rowsize());
+            setPRow(_fitorder,pos[n],_bounds,mProwi);
+            mP.row(k) = mProwi.transpose();
+#endif
+        }
+        mP = inverseSigma EIGEN_asDiag() * mP;
+        xdbg<<"after mP = sigma * mP\n";
+
+#ifdef USE_TMV
+        _f.reset(new DMatrix(mUS/mP));
+#else
+        _f.reset(new DMatrix(_fitsize,_npca));
+        mP.qr().solve(mUS,&(*_f));
+#endif
+        xdbg<<"Done making FittedPSF\n";
+
+        //
+        // Remove outliers from the fit using the empirical covariance matrix
+        // of the data with respect to the fitted values.
+        //
+        xdbg<<"Checking for outliers:\n";
+
+        // The residuals of each star from the fit.
+        // Each star is independent, so do them in parallel.
+        DMatrix mD(ngood_psf,psfsize);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for(int k=0;k<ngood_psf;++k) {
+            const int n = good[k];
+            DVector fit(psfsize);
+            interpolateExact(pos[n],TMV_vview(fit));
+#ifdef USE_TMV
+            mD.row(k) = psf[n].vec() - fit;
+#else
+            mD.row(k) = (psf[n].vec() - fit).transpose();
+#endif
+        }
+
+        // Calculate the covariance matrix
+        DMatrix cov = mD.transpose() * mD;
+
+        chisq = (mP * *_f - mUS).TMV_normSq();
+        dbg<<"chisq calculation #1 = "<<chisq<<std::endl;
+        dof = ngood_psf - _fitsize;
+
+        if (dof > 0) {
+            cov /= double(dof);
+        }
+#ifdef USE_TMV
+        cov.divideUsing(tmv::SV);
+        cov.saveDiv();
+        cov.setDiv();
+        dbg<<"cov S = "<<cov.svd().getS().diag()<<std::endl;
+        // Use an explicit (pseudo-)inverse, so the loop below doesn't
+        // share the division object across threads.
+        DMatrix covinv(psfsize,psfsize);
+        cov.makeInverse(covinv);
+#else
+        Eigen::SVD<DMatrix> cov_svd = cov.svd();
+        dbg<<"cov S = "<<EIGEN_Transpose(cov_svd.singularValues())<<std::endl;
+
+#endif
+
+        // Clip out 3 sigma outliers:
+        // Each star's dev goes into its own slot, and the sums are done
+        // serially below, so chisq doesn't depend on the number of threads.
+        std::vector<double> devs(ngood_psf);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for(int k=0;k<ngood_psf;++k) {
+#ifdef USE_TMV
+            DVector diff = mD.row(k);
+            devs[k] = diff * covinv * diff;
+#else
+            DVector diff = mD.row(k).transpose();
+            DVector temp(psfsize);
+            cov_svd.solve(diff,&temp);
+            devs[k] = (diff.transpose() * temp)(0,0);
+#endif
+        }
+        noutliers = 0;
+        chisq = 0;
+        for(int k=0;k<ngood_psf;++k) {
+            const int n = good[k];
+            chisq += devs[k];
+            if (devs[k] > outlier_thresh) {
+                xdbg<<"n = "<<n<<" is an outlier.\n";
+                xdbg<<"data = "<<psf[n].vec()<<std::endl;
+                xdbg<<"dev = "<<devs[k]<<std::endl;
+                ++noutliers;
+                flags[n] |= PSF_INTERP_OUTLIER;
+            }
+        }
+        dbg<<"ngoodpsf = "<<ngood_psf<<std::endl;
+        dbg<<"noutliers = "<<noutliers<<std::endl;
+        dbg<<"chisq calculation #2 = "<<chisq<<std::endl;
+
+    } while (noutliers > 0);
+
+    log._noutliers = noutliers;
+    log._nfit = ngood_psf;
+    log._npc = _npca;
+    log._chisq_fit = chisq;
+    log._dof_fit = dof;
+
+}
+
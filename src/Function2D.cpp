@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include <complex>
 #include <iostream>
 #include <vector>
@@ -117,6 +118,46 @@ void Polynomial2D::write(std::ostream& fout) const
     fout.precision(oldPrec);
 }
 
+// The positions are done in blocks, with the loops over the points in 
+// each block innermost.  These have no dependencies between iterations,
+// so the compiler can vectorize them.
+static const int EVAL_BLOCK = 64;
+
+void Polynomial2D::evaluateMany(
+    const std::vector<Position>& pos, std::vector<double>& f) const
+{
+    const int n = pos.size();
+    f.resize(n);
+    const DMatrix& c = *_coeffs;
+
+    double x[EVAL_BLOCK], y[EVAL_BLOCK], fy[EVAL_BLOCK], r[EVAL_BLOCK];
+    for(int n1=0;n1<n;n1+=EVAL_BLOCK) {
+        const int nb = std::min(EVAL_BLOCK,n-n1);
+        for(int k=0;k<nb;++k) {
+            x[k] = pos[n1+k].getX()/_scale;
+            y[k] = pos[n1+k].getY()/_scale;
+        }
+        for(int k=0;k<nb;++k) r[k] = 0.;
+
+        // Horner's rule in x, where the coefficient of each power of x
+        // is a polynomial in y, also done with Horner's rule.
+        for(int i=_xorder;i>=0;--i) {
+            // The fits are usually only of total order max(xorder,yorder),
+            // so skip the zeros at the end of each row.
+            int jtop = _yorder;
+            while (jtop > 0 && c(i,jtop) == 0.) --jtop;
+            const double cy = c(i,jtop);
+            for(int k=0;k<nb;++k) fy[k] = cy;
+            for(int j=jtop-1;j>=0;--j) {
+                const double cij = c(i,j);
+                for(int k=0;k<nb;++k) fy[k] = fy[k]*y[k] + cij;
+            }
+            for(int k=0;k<nb;++k) r[k] = r[k]*x[k] + fy[k];
+        }
+        for(int k=0;k<nb;++k) f[n1+k] = r[k];
+    }
+}
+
 void Polynomial2D::addLinear(double a, double b, double c)
 {
     (*_coeffs)(0,0) += a;
@@ -298,6 +339,14 @@ double Function2D::operator()(double x,double y) const
     return result;
 }
 
+void Function2D::evaluateMany(
+    const std::vector<Position>& pos, std::vector<double>& f) const
+{
+    const int n = pos.size();
+    f.resize(n);
+    for(int i=0;i<n;++i) f[i] = (*this)(pos[i]);
+}
+
 std::auto_ptr<Function2D> Function2D::read(std::istream& fin) 
 {
     char fc,tc;
@@ -481,6 +530,187 @@ void Function2D::doSimpleFit(
     xdbg<<"Done simple fit\n";
 }
 
+void Function2D::makeDesign(
+    int order, const std::vector<Position>& pos,
+    const std::vector<double>& vals, const std::vector<double>* sigList,
+    DMatrix& P, DVector& V) const
+{
+    // This uses the same ordering of the pq terms as doSimpleFit.
+    // Note that for this ordering, the terms for a fit of any lower order
+    // are just the first fitSize(order',order') columns of P.
+    Assert(pos.size() == vals.size());
+    Assert((sigList==0) || (sigList->size() == vals.size()));
+    const int nVals = vals.size();
+    Assert(int(P.TMV_colsize()) == nVals);
+    Assert(int(P.TMV_rowsize()) == fitSize(order,order));
+    Assert(int(V.size()) == nVals);
+
+    for(int i=0;i<nVals;++i) {
+        DVector px = definePX(order,pos[i].getX());
+        DVector py = definePY(order,pos[i].getY());
+        int pq=0;
+        for(int pplusq=0;pplusq<=order;++pplusq) { 
+            for(int p=pplusq,q=0;q<=pplusq;--p,++q,++pq) {
+                P(i,pq) = px[p]*py[q];
+            }
+        }
+        Assert(pq == int(P.TMV_rowsize()));
+        if (sigList) {
+            Assert((*sigList)[i] > 0.);
+            V(i) = vals[i]/(*sigList)[i];
+            P.row(i) /= (*sigList)[i];
+        } else {
+            V(i) = vals[i];
+        }
+    }
+}
+
+// The outlier and order fits do many fits of the same data, either 
+// with a few rows removed each time, or with fewer columns.  
+// So rather than redo the QR decomposition of P each time, this keeps 
+// the normal equations, (Pt P) f = Pt V, for the rows in use.  
+// Removing a row is then just a rank-1 downdate of these, and a fit of 
+// lower order uses the upper-left block.  Each solution is followed by 
+// one step of iterative refinement with the actual residuals, which
+// recovers most of the accuracy lost by squaring the condition number 
+// of P.
+class IncrementalFit
+{
+public :
+
+    IncrementalFit(
+        const DMatrix& P, const DVector& V, const std::vector<bool>& use) :
+        _P(P), _V(V), _use(use), _nrows(P.TMV_colsize()),
+        _ncols(P.TMV_rowsize()), _nuse(0), _ata(_ncols,_ncols), _atv(_ncols)
+    {
+        Assert(int(_use.size()) == _nrows);
+        _ata.setZero();
+        _atv.setZero();
+        for(int i=0;i<_nrows;++i) if (_use[i]) update(i,1.);
+    }
+
+    void remove(int i)
+    {
+        Assert(_use[i]);
+        update(i,-1.);
+        _use[i] = false;
+    }
+
+    int getNUse() const { return _nuse; }
+
+    // Solve for the fit using the first size columns of P.
+    // diff is set to the residuals (0 for the rows not used).
+    // Returns false if the normal equations aren't positive definite,
+    // in which case the caller should fall back to doSimpleFit.
+    bool solve(int size, DVector& f, DVector& diff, DMatrix* cov) const
+    {
+        Assert(size <= _ncols);
+        Assert(int(f.size()) == size);
+        Assert(int(diff.size()) == _nrows);
+        DMatrix L(size,size);
+        if (!cholesky(size,L)) return false;
+
+        DVector rhs(size);
+        for(int j=0;j<size;++j) rhs(j) = _atv(j);
+        cholSolve(L,rhs,f);
+        calculateDiff(f,diff);
+
+        // Refine with the residuals: f += (Pt P)^-1 Pt diff
+        rhs.setZero();
+        for(int i=0;i<_nrows;++i) if (_use[i]) {
+            for(int j=0;j<size;++j) rhs(j) += diff(i) * _P(i,j);
+        }
+        DVector df(size);
+        cholSolve(L,rhs,df);
+        f += df;
+        calculateDiff(f,diff);
+
+        if (cov) {
+            Assert(int(cov->TMV_colsize()) == size);
+            Assert(int(cov->TMV_rowsize()) == size);
+            DVector e(size);
+            DVector col(size);
+            for(int k=0;k<size;++k) {
+                e.setZero();
+                e(k) = 1.;
+                cholSolve(L,e,col);
+                for(int j=0;j<size;++j) (*cov)(j,k) = col(j);
+            }
+        }
+        return true;
+    }
+
+private :
+
+    void update(int i, double sign)
+    {
+        for(int j=0;j<_ncols;++j) {
+            const double pj = sign * _P(i,j);
+            for(int k=0;k<=j;++k) _ata(j,k) += pj * _P(i,k);
+            _atv(j) += pj * _V(i);
+        }
+        _nuse += sign > 0. ? 1 : -1;
+    }
+
+    // Lower triangular L with L Lt = the upper-left size x size block 
+    // of Pt P.  (Only the lower triangle of _ata is kept.)
+    bool cholesky(int size, DMatrix& L) const
+    {
+        L.setZero();
+        for(int j=0;j<size;++j) {
+            double d = _ata(j,j);
+            for(int k=0;k<j;++k) d -= L(j,k)*L(j,k);
+            if (!(d > 1.e-12 * std::abs(_ata(j,j))) || !(d > 0.)) {
+                xdbg<<"IncrementalFit: normal equations are singular\n";
+                return false;
+            }
+            L(j,j) = std::sqrt(d);
+            for(int i=j+1;i<size;++i) {
+                double s = _ata(i,j);
+                for(int k=0;k<j;++k) s -= L(i,k)*L(j,k);
+                L(i,j) = s / L(j,j);
+            }
+        }
+        return true;
+    }
+
+    static void cholSolve(const DMatrix& L, const DVector& b, DVector& x)
+    {
+        const int size = b.size();
+        for(int i=0;i<size;++i) {
+            double s = b(i);
+            for(int k=0;k<i;++k) s -= L(i,k)*x(k);
+            x(i) = s / L(i,i);
+        }
+        for(int i=size-1;i>=0;--i) {
+            double s = x(i);
+            for(int k=i+1;k<size;++k) s -= L(k,i)*x(k);
+            x(i) = s / L(i,i);
+        }
+    }
+
+    void calculateDiff(const DVector& f, DVector& diff) const
+    {
+        const int size = f.size();
+        for(int i=0;i<_nrows;++i) {
+            if (_use[i]) {
+                double fi = 0.;
+                for(int j=0;j<size;++j) fi += _P(i,j) * f(j);
+                diff(i) = _V(i) - fi;
+            } else {
+                diff(i) = 0.;
+            }
+        }
+    }
+
+    const DMatrix& _P;
+    const DVector& _V;
+    std::vector<bool> _use;
+    int _nrows, _ncols, _nuse;
+    DMatrix _ata;
+    DVector _atv;
+};
+
 void Function2D::simpleFit(
     int order, const std::vector<Position>& pos, 
     const std::vector<double>& vals, const std::vector<bool>& use, 
@@ -511,16 +741,26 @@ void Function2D::outlierFit(
 {
     xdbg<<"start outlier fit\n";
     const int nVals = vals.size();
+    const int size = fitSize(order,order);
     bool isDone=false;
-    DVector fVect(fitSize(order,order));
+    DVector fVect(size);
     int dof;
     double chisq=0.;
     double nSigSq = nSig*nSig;
+    Assert(use->size() == vals.size());
+    DMatrix P(nVals,size);
+    DVector V(nVals);
+    makeDesign(order,pos,vals,sig,P,V);
+    IncrementalFit fit(P,V,*use);
     while (!isDone) {
         DVector diff(nVals);
-        xdbg<<"before dosimple\n";
-        doSimpleFit(order,order,pos,vals,*use,&fVect,sig,&dof,&diff,cov);
-        xdbg<<"after dosimple\n";
+        xdbg<<"before fit\n";
+        if (fit.solve(size,fVect,diff,cov)) {
+            dof = std::max(fit.getNUse() - size, 0);
+        } else {
+            doSimpleFit(order,order,pos,vals,*use,&fVect,sig,&dof,&diff,cov);
+        }
+        xdbg<<"after fit\n";
         // Caclulate chisq, keeping the vector diffsq for later when
         // looking for outliers
         chisq = diff.TMV_normSq();
@@ -539,6 +779,7 @@ void Function2D::outlierFit(
             if (absSq(diff[i]) > thresh) {
                 isDone = false; 
                 (*use)[i] = false;
+                fit.remove(i);
                 xdbg<<i<<" ";
             }
         }
@@ -577,11 +818,25 @@ void Function2D::orderFit(
     double *chisqOut, int *dofOut, DMatrix* cov) 
 {
     xdbg<<"Start OrderFit\n";
-    DVector fVectMax(fitSize(max_order,max_order));
-    DVector diff(vals.size());
+    // All of the lower order fits use a subset of the columns of the 
+    // max_order design matrix, so the normal equations only need to be
+    // built once.
+    const int nVals = vals.size();
+    const int max_size = fitSize(max_order,max_order);
+    DMatrix P(nVals,max_size);
+    DVector V(nVals);
+    makeDesign(max_order,pos,vals,sig,P,V);
+    IncrementalFit fit(P,V,use);
+
+    DVector fVectMax(max_size);
+    DVector diff(nVals);
     int dof_max;
-    doSimpleFit(max_order,max_order,pos,vals,use,
-                &fVectMax,sig,&dof_max,&diff,cov);
+    if (fit.solve(max_size,fVectMax,diff,cov)) {
+        dof_max = std::max(fit.getNUse() - max_size, 0);
+    } else {
+        doSimpleFit(max_order,max_order,pos,vals,use,
+                    &fVectMax,sig,&dof_max,&diff,cov);
+    }
     double chisq_max = diff.TMV_normSq();
     xdbg<<"chisq,dof(n="<<max_order<<") = "<<chisq_max<<','<<dof_max<<std::endl;
     int try_order;
@@ -589,9 +844,14 @@ void Function2D::orderFit(
     int dof=-1;
     std::auto_ptr<DVector > fVect(0);
     for(try_order=0;try_order<max_order;++try_order) {
-        fVect.reset(new DVector(fitSize(try_order,try_order)));
-        doSimpleFit(try_order,try_order,pos,vals,use,
-                    fVect.get(),sig,&dof,&diff,cov);
+        const int size = fitSize(try_order,try_order);
+        fVect.reset(new DVector(size));
+        if (fit.solve(size,*fVect,diff,cov)) {
+            dof = std::max(fit.getNUse() - size, 0);
+        } else {
+            doSimpleFit(try_order,try_order,pos,vals,use,
+                        fVect.get(),sig,&dof,&diff,cov);
+        }
         chisq = diff.TMV_normSq();
         xdbg<<"chisq,dof(n="<<try_order<<") = "<<chisq<<','<<dof<<"....  ";
         if (Equivalent(chisq_max,chisq,dof_max,dof,equiv_prob)) {
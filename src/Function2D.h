@@ -4,6 +4,7 @@
 #include <iostream>
 #include <functional>
 #include <memory>
+#include <vector>
 #include "MyMatrix.h"
 #include "dbg.h"
 #include "Bounds.h"
@@ -72,6 +73,10 @@ public:
     double operator()(const Position& p) const 
     { return operator()(p.getX(),p.getY()); }
 
+    // Evaluate the function at a list of positions: f[i] = (*this)(pos[i])
+    virtual void evaluateMany(
+        const std::vector<Position>& pos, std::vector<double>& f) const;
+
     virtual void setTo(double value) 
     {
         if (_xorder || _yorder) {
@@ -148,6 +153,14 @@ private:
         const std::vector<bool>& use, DVector *f, 
         const std::vector<double>* sig_list=0, int *dof=0,
         DVector *diff=0, DMatrix* cov=0);
+
+    // Fill the rows of P with the basis functions at each position
+    // (all of them, regardless of use), and V with the values.
+    // Both are divided by sig_list if it is given.
+    void makeDesign(
+        int order, const std::vector<Position>& pos,
+        const std::vector<double>& v, const std::vector<double>* sig_list,
+        DMatrix& P, DVector& V) const;
 };
 
 inline std::ostream& operator<<(std::ostream& fout, const Function2D& f)
@@ -176,6 +189,10 @@ public:
     virtual double operator()(double ,double ) const 
     { return (*this->_coeffs)(0,0); }
 
+    virtual void evaluateMany(
+        const std::vector<Position>& pos, std::vector<double>& f) const
+    { f.assign(pos.size(),(*this->_coeffs)(0,0)); }
+
     virtual void write(std::ostream& fout) const;
 
     virtual std::auto_ptr<Function2D> dFdX() const 
@@ -248,6 +265,9 @@ public:
 
     virtual void write(std::ostream& fout) const;
 
+    virtual void evaluateMany(
+        const std::vector<Position>& pos, std::vector<double>& f) const;
+
     virtual std::auto_ptr<Function2D> dFdX() const;
 
     virtual std::auto_ptr<Function2D> dFdY() const;
@@ -37,6 +37,27 @@ public:
         _m(new TMatrixView(T)(TMV_view(*_source))) 
     { _source->setZero(); }
 
+    // Create blank image covering the given bounds
+    Image(const Bounds& b) :
+        _filename(""), _hdu(0),
+        _xmin(int(floor(b.getXMin()))), _xmax(int(ceil(b.getXMax()))), 
+        _ymin(int(floor(b.getYMin()))), _ymax(int(ceil(b.getYMax()))),
+        _source(new TMatrix(T)(_xmax-_xmin,_ymax-_ymin)),
+        _m(new TMatrixView(T)(TMV_view(*_source))) 
+    { _source->setZero(); }
+
+#ifdef USE_TMV
+    // View of existing storage (no copy).  The data are column major
+    // with x varying fastest, as in the MEDS mosaics.  The caller must 
+    // keep data alive for the lifetime of this Image.
+    Image(T* data, int x_size, int y_size) :
+        _filename(""), _hdu(0),
+        _xmin(0),_xmax(x_size),_ymin(0),_ymax(y_size),
+        _source(0),
+        _m(new TMatrixView(T)(
+                tmv::MatrixViewOf(data,x_size,y_size,tmv::ColMajor))) {}
+#endif
+
     // New copy of image
     Image(const Image& rhs) : 
         _filename(""), _hdu(0),
@@ -0,0 +1,97 @@
+#ifndef ImageTileCacheH
+#define ImageTileCacheH
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include "boost/shared_ptr.hpp"
+#include "MyMatrix.h"
+#include "Image.h"
+#include "Bounds.h"
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+// ImageTileCache gives access to small stamps of a large fits image
+// without reading the whole image into memory.
+//
+// The image is divided into square tiles of tile_size pixels on a side,
+// which are read from the file as they are needed and kept in memory
+// until the total size of the cached tiles exceeds max_mem bytes, at
+// which point the least recently used tiles are dropped.
+//
+// The file stays open for the lifetime of the cache, so repeated stamps
+// from the same image don't need to re-open the file.  For tile-compressed
+// images, cfitsio only decompresses the compression tiles that overlap
+// each of our tiles, so it is most efficient to make tile_size a multiple
+// of the compression tile size (or the full row length for row-compressed
+// images).
+//
+// getStamp is safe to call from multiple threads.
+
+template <typename T>
+class ImageTileCache
+{
+public :
+
+    ImageTileCache(
+        const std::string& filename, int hdu,
+        int tile_size=256, double max_mem=200.*1024.*1024.);
+    ~ImageTileCache();
+
+    // Return a new image covering the given bounds, clipped to the
+    // bounds of the full image.  The returned image always has at
+    // least one pixel.
+    std::auto_ptr<Image<T> > getStamp(const Bounds& b) const;
+
+    Bounds getBounds() const { return Bounds(0,_xsize,0,_ysize); }
+    const std::string& getFileName() const { return _filename; }
+
+    int getNHits() const { return _nhits; }
+    int getNMisses() const { return _nmisses; }
+    double getMemoryUsed() const { return _mem; }
+
+private :
+
+    typedef boost::shared_ptr<const TMatrix(T)> Tile;
+    typedef std::pair<int,int> TileKey;
+    typedef std::pair<TileKey,Tile> TileEntry;
+    typedef std::list<TileEntry> TileList;
+    typedef std::map<TileKey,typename TileList::iterator> TileMap;
+
+    Tile getTile(int tx, int ty) const;
+    Tile readTile(int tx, int ty) const;
+    bool findTile(const TileKey& key, Tile& tile) const;
+    void addTile(const TileKey& key, const Tile& tile) const;
+
+    std::string _filename;
+    int _hdu;
+    int _tile_size;
+    double _max_mem;
+    int _xsize, _ysize;
+    fitsfile* _fptr;
+
+    // The tiles are kept in a list in order of use, most recent first,
+    // and the map points to the list entries.
+    mutable TileList _tile_list;
+    mutable TileMap _tile_map;
+    mutable double _mem;
+    mutable int _nhits;
+    mutable int _nmisses;
+
+#ifdef _OPENMP
+    // _map_lock protects the tile list and map (and the counts above), 
+    // and _file_lock protects _fptr.  When both are held, _file_lock 
+    // is taken first.
+    mutable omp_lock_t _map_lock;
+    mutable omp_lock_t _file_lock;
+#endif
+
+    // Not copyable.
+    ImageTileCache(const ImageTileCache&);
+    void operator=(const ImageTileCache&);
+};
+
+#endif
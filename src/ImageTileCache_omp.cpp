@@ -0,0 +1,229 @@
+
+#include <algorithm>
+#include "ImageTileCache.h"
+#include "Params.h"
+#include "ConfigFile.h"
+
+#ifdef _OPENMP
+#define TILE_LOCK(lock) omp_set_lock(&lock)
+#define TILE_UNLOCK(lock) omp_unset_lock(&lock)
+#else
+#define TILE_LOCK(lock)
+#define TILE_UNLOCK(lock)
+#endif
+
+template <typename T>
+inline int getTileDataType() { return 0; }
+
+template <>
+inline int getTileDataType<double>() { return TDOUBLE; }
+template <>
+inline int getTileDataType<float>() { return TFLOAT; }
+template <>
+inline int getTileDataType<int>() { return TINT; }
+
+template <typename T>
+ImageTileCache<T>::ImageTileCache(
+    const std::string& filename, int hdu, int tile_size, double max_mem) :
+    _filename(filename), _hdu(hdu), _tile_size(tile_size), _max_mem(max_mem),
+    _xsize(0), _ysize(0), _fptr(0), _mem(0.), _nhits(0), _nmisses(0)
+{
+    dbg<<"Start ImageTileCache: "<<_filename<<" hdu "<<_hdu<<std::endl;
+    dbg<<"tile_size = "<<_tile_size<<", max_mem = "<<_max_mem<<std::endl;
+    Assert(_tile_size > 0);
+
+    int fitsErr=0;
+    fits_open_file(&_fptr,_filename.c_str(),READONLY,&fitsErr);
+    if (fitsErr != 0) {
+        fits_report_error(stderr,fitsErr);
+        throw ReadException(
+            "Error opening fits file " + _filename);
+    }
+
+    fits_movabs_hdu(_fptr,_hdu,0,&fitsErr);
+    if (fitsErr != 0) {
+        fits_report_error(stderr,fitsErr);
+        fitsErr = 0;
+        fits_close_file(_fptr,&fitsErr);
+        throw ReadException(
+            "Error reading from " + _filename +
+            " moving to hdu " + ConvertibleString(_hdu));
+    }
+
+    int bitPix, nAxes;
+    long sizes[2];
+    fits_get_img_param(_fptr, int(2), &bitPix, &nAxes, sizes, &fitsErr);
+    if (fitsErr != 0 || nAxes != 2) {
+        if (fitsErr != 0) fits_report_error(stderr,fitsErr);
+        fitsErr = 0;
+        fits_close_file(_fptr,&fitsErr);
+        throw ReadException(
+            "Error reading from " + _filename +
+            " hdu " + ConvertibleString(_hdu) +
+            " getting image parameters");
+    }
+    _xsize = sizes[0];
+    _ysize = sizes[1];
+    dbg<<"sizes = "<<_xsize<<"  "<<_ysize<<std::endl;
+
+#ifdef _OPENMP
+    omp_init_lock(&_map_lock);
+    omp_init_lock(&_file_lock);
+#endif
+}
+
+template <typename T>
+ImageTileCache<T>::~ImageTileCache()
+{
+    dbg<<"ImageTileCache "<<_filename<<": nhits = "<<_nhits<<
+        ", nmisses = "<<_nmisses<<", mem = "<<_mem<<std::endl;
+    int fitsErr=0;
+    fits_close_file(_fptr,&fitsErr);
+    if (fitsErr != 0) fits_report_error(stderr,fitsErr);
+#ifdef _OPENMP
+    omp_destroy_lock(&_map_lock);
+    omp_destroy_lock(&_file_lock);
+#endif
+}
+
+// Read the tile from the file.  Must be called with _file_lock held,
+// since the fitsfile can't be shared across threads.
+template <typename T>
+typename ImageTileCache<T>::Tile ImageTileCache<T>::readTile(
+    int tx, int ty) const
+{
+    int x1 = tx * _tile_size;
+    int x2 = std::min(x1 + _tile_size, _xsize);
+    int y1 = ty * _tile_size;
+    int y2 = std::min(y1 + _tile_size, _ysize);
+    xdbg<<"Read tile "<<tx<<','<<ty<<": "<<x1<<','<<x2<<','<<y1<<','<<y2<<std::endl;
+
+    boost::shared_ptr<TMatrix(T)> tile(new TMatrix(T)(x2-x1,y2-y1));
+    long fPixel[2] = {x1+1,y1+1};
+    long lPixel[2] = {x2,y2};
+    long inc[2] = {1,1};
+    int anynul;
+    int fitsErr=0;
+    Assert(getTileDataType<T>());
+    fits_read_subset(_fptr,getTileDataType<T>(),fPixel,lPixel,inc,
+                     0,TMV_ptr(*tile),&anynul,&fitsErr);
+    if (fitsErr != 0) {
+        fits_report_error(stderr,fitsErr);
+        throw ReadException(
+            "Error reading from " + _filename +
+            " hdu " + ConvertibleString(_hdu) +
+            " reading pixel data");
+    }
+    return tile;
+}
+
+// Look for the tile in the cache, and if it is there, move it to the 
+// front of the list.  Must be called with _map_lock held.
+template <typename T>
+bool ImageTileCache<T>::findTile(const TileKey& key, Tile& tile) const
+{
+    typename TileMap::iterator it = _tile_map.find(key);
+    if (it == _tile_map.end()) return false;
+    _tile_list.splice(_tile_list.begin(),_tile_list,it->second);
+    tile = it->second->second;
+    ++_nhits;
+    return true;
+}
+
+// Add a new tile to the cache.  Must be called with _map_lock held.
+template <typename T>
+void ImageTileCache<T>::addTile(const TileKey& key, const Tile& tile) const
+{
+    double tile_mem = double(tile->TMV_colsize()) *
+        double(tile->TMV_rowsize()) * sizeof(T);
+    // Drop the least recently used tiles until this one fits.
+    // Any tiles still in use by a caller stay alive through
+    // the caller's shared_ptr.
+    while (!_tile_list.empty() && _mem + tile_mem > _max_mem) {
+        const Tile& old = _tile_list.back().second;
+        _mem -= double(old->TMV_colsize()) *
+            double(old->TMV_rowsize()) * sizeof(T);
+        _tile_map.erase(_tile_list.back().first);
+        _tile_list.pop_back();
+    }
+    _tile_list.push_front(TileEntry(key,tile));
+    _tile_map[key] = _tile_list.begin();
+    _mem += tile_mem;
+}
+
+template <typename T>
+typename ImageTileCache<T>::Tile ImageTileCache<T>::getTile(
+    int tx, int ty) const
+{
+    TileKey key(tx,ty);
+    Tile tile;
+
+    // Most calls are hits, which only need the map lock.
+    TILE_LOCK(_map_lock);
+    bool found = findTile(key,tile);
+    TILE_UNLOCK(_map_lock);
+    if (found) return tile;
+
+    // Otherwise read it from the file.  Other threads can still get 
+    // tiles that are already in memory while we read.
+    TILE_LOCK(_file_lock);
+    // Another thread may have read the tile while we were waiting.
+    TILE_LOCK(_map_lock);
+    found = findTile(key,tile);
+    if (!found) ++_nmisses;
+    TILE_UNLOCK(_map_lock);
+    if (!found) {
+        try {
+            tile = readTile(tx,ty);
+        } catch (ReadException&) {
+            TILE_UNLOCK(_file_lock);
+            throw;
+        }
+        TILE_LOCK(_map_lock);
+        addTile(key,tile);
+        TILE_UNLOCK(_map_lock);
+    }
+    TILE_UNLOCK(_file_lock);
+    return tile;
+}
+
+template <typename T>
+std::auto_ptr<Image<T> > ImageTileCache<T>::getStamp(const Bounds& b) const
+{
+    // Clip to the image the same way Image::readFits does, but also
+    // make sure the stamp has at least one pixel in the image.
+    int x1 = int(floor(b.getXMin()));
+    int x2 = int(ceil(b.getXMax()));
+    int y1 = int(floor(b.getYMin()));
+    int y2 = int(ceil(b.getYMax()));
+    if (x1 < 0) x1 = 0; if (x1 > _xsize-1) x1 = _xsize-1;
+    if (y1 < 0) y1 = 0; if (y1 > _ysize-1) y1 = _ysize-1;
+    if (x2 > _xsize) x2 = _xsize; if (x2 < x1+1) x2 = x1+1;
+    if (y2 > _ysize) y2 = _ysize; if (y2 < y1+1) y2 = y1+1;
+    xdbg<<"getStamp "<<b<<" -> "<<x1<<','<<x2<<','<<y1<<','<<y2<<std::endl;
+
+    std::auto_ptr<Image<T> > stamp(new Image<T>(Bounds(x1,x2,y1,y2)));
+
+    const int tx1 = x1 / _tile_size;
+    const int tx2 = (x2-1) / _tile_size;
+    const int ty1 = y1 / _tile_size;
+    const int ty2 = (y2-1) / _tile_size;
+    for(int ty=ty1;ty<=ty2;++ty) for(int tx=tx1;tx<=tx2;++tx) {
+        Tile tile = getTile(tx,ty);
+        // The overlap of this tile with the stamp:
+        const int tile_x0 = tx * _tile_size;
+        const int tile_y0 = ty * _tile_size;
+        const int i1 = std::max(x1,tile_x0);
+        const int i2 = std::min(x2,tile_x0+_tile_size);
+        const int j1 = std::max(y1,tile_y0);
+        const int j2 = std::min(y2,tile_y0+_tile_size);
+        stamp->getM().TMV_subMatrix(i1-x1,i2-x1,j1-y1,j2-y1) =
+            tile->TMV_subMatrix(
+                i1-tile_x0,i2-tile_x0,j1-tile_y0,j2-tile_y0);
+    }
+    return stamp;
+}
+
+template class ImageTileCache<double>;
+template class ImageTileCache<float>;
+template class ImageTileCache<int>;
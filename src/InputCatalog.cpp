@@ -12,12 +12,14 @@
 void InputCatalog::flagStars(const StarCatalog& starcat)
 {
     const int ngals = _id.size();
+    std::vector<bool> is_star;
+    starcat.isStarMany(_id,is_star);
     for (int i=0; i<ngals; ++i) {
         xdbg<<"i = "<<i<<", id[i] = "<<_id[i]<<std::endl;
         // It doesn't seem worth making a separate flag for this.
         // If it's considered a star, let's just admit that it's too small 
         // to bother trying to measure a shear for it.
-        if (starcat.isStar(_id[i])) {
+        if (is_star[i]) {
             xdbg<<"Flag this one as a star\n";
             _flags[i] |= TOO_SMALL;
             xdbg<<i<<" is a star: flag -> "<<_flags[i]<<std::endl;
@@ -71,6 +71,70 @@ void Legendre2D::write(std::ostream& fout) const
     fout.flags(oldf);
 }
 
+// As for Polynomial2D, the positions are done in blocks with the loops 
+// over the points innermost, so the compiler can vectorize them.
+static const int EVAL_BLOCK = 64;
+
+// This uses Clenshaw's recurrence in each direction.  With 
+// P_k+1(t) = (2k+1)/(k+1) t P_k(t) - k/(k+1) P_k-1(t), 
+// Sum_k c_k P_k(t) = b_0 where b_N+1 = b_N+2 = 0 and
+// b_k = c_k + (2k+1)/(k+1) t b_k+1 - (k+1)/(k+2) b_k+2.
+void Legendre2D::evaluateMany(
+    const std::vector<Position>& pos, std::vector<double>& f) const
+{
+    const int n = pos.size();
+    f.resize(n);
+    const DMatrix& c = *_coeffs;
+    const double xmin = getXMin(), xmax = getXMax();
+    const double ymin = getYMin(), ymax = getYMax();
+
+    for(int i=0;i<n;++i) {
+        const double x = pos[i].getX();
+        const double y = pos[i].getY();
+        if (x < xmin || x > xmax || y < ymin || y > ymax) {
+            dbg<<"Error: pos = "<<pos[i]<<", bounds = "<<_bounds<<std::endl;
+            throw RangeException(pos[i],_bounds);
+        }
+    }
+
+    double x[EVAL_BLOCK], y[EVAL_BLOCK];
+    double by1[EVAL_BLOCK], by2[EVAL_BLOCK];
+    double bx1[EVAL_BLOCK], bx2[EVAL_BLOCK];
+    for(int n1=0;n1<n;n1+=EVAL_BLOCK) {
+        const int nb = std::min(EVAL_BLOCK,n-n1);
+        for(int k=0;k<nb;++k) {
+            x[k] = (2.*pos[n1+k].getX()-xmin-xmax)/(xmax-xmin);
+            y[k] = (2.*pos[n1+k].getY()-ymin-ymax)/(ymax-ymin);
+        }
+        for(int k=0;k<nb;++k) bx1[k] = bx2[k] = 0.;
+
+        for(int i=_xorder;i>=0;--i) {
+            // The coefficient of P_i(x) is a sum over P_j(y).
+            int jtop = _yorder;
+            while (jtop > 0 && c(i,jtop) == 0.) --jtop;
+            for(int k=0;k<nb;++k) by1[k] = by2[k] = 0.;
+            for(int j=jtop;j>=0;--j) {
+                const double cij = c(i,j);
+                const double aj = (2.*j+1.)/(j+1.);
+                const double gj = (j+1.)/(j+2.);
+                for(int k=0;k<nb;++k) {
+                    const double b = cij + aj*y[k]*by1[k] - gj*by2[k];
+                    by2[k] = by1[k];
+                    by1[k] = b;
+                }
+            }
+            const double ai = (2.*i+1.)/(i+1.);
+            const double gi = (i+1.)/(i+2.);
+            for(int k=0;k<nb;++k) {
+                const double b = by1[k] + ai*x[k]*bx1[k] - gi*bx2[k];
+                bx2[k] = bx1[k];
+                bx1[k] = b;
+            }
+        }
+        for(int k=0;k<nb;++k) f[n1+k] = bx1[k];
+    }
+}
+
 void Legendre2D::addLinear(double a, double b, double c)
 {
     double xAve = (getXMin() + getXMax())/2.;
@@ -32,6 +32,9 @@ public:
 
     virtual void write(std::ostream& fout) const;
 
+    virtual void evaluateMany(
+        const std::vector<Position>& pos, std::vector<double>& f) const;
+
     virtual std::auto_ptr<Function2D> dFdX() const;
 
     virtual std::auto_ptr<Function2D> dFdY() const;
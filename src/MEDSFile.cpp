@@ -47,13 +47,8 @@ void MEDSFile::getPixels(std::vector<PixelList>& pix_list, long i, long& flag) c
 
     boost::shared_ptr<double> wtpix(meds_get_weight_mosaicp(_medsPtr,i,&ncutout,&nrow,&ncol),free);
 
-    // We'll convert these one at a time to an Image object.
-    Image<double> im(ncol,nrow);
-    Image<double> wtim(ncol,nrow);
-
 #if 0
     boost::shared_ptr<int> segpix(meds_get_seg_mosaicp(_medsPtr,i,&ncutout,&nrow,&ncol),free);
-    Image<int> segim(ncol,nrow);
 #endif
 
     pix_list.resize(ncutout-1);
@@ -68,11 +63,13 @@ void MEDSFile::getPixels(std::vector<PixelList>& pix_list, long i, long& flag) c
         Assert(id != 0);  // id = 0 should be at j=0.
         if (id == 0) continue; // Skip id = 0, which is the coadd image.
 
-        // Get the images
-        im.getM() = tmv::MatrixViewOf(pix.get()+j*npix, ncol, nrow, tmv::ColMajor);
-        wtim.getM() = tmv::MatrixViewOf(wtpix.get()+j*npix, ncol, nrow, tmv::ColMajor);
+        // Get the images.  These are views into the mosaic buffers, 
+        // so GetPixList reads the cutout pixels directly without an 
+        // intermediate copy.
+        Image<double> im(pix.get()+j*npix, ncol, nrow);
+        Image<double> wtim(wtpix.get()+j*npix, ncol, nrow);
 #if 0
-        segim.getM() = tmv::MatrixViewOf(segpix.get()+j*npix,ncol,nrow,tmv::ColMajor);
+        Image<int> segim(segpix.get()+j*npix, ncol, nrow);
 #endif
 
         // Get the location of the center pixel
@@ -108,6 +105,7 @@ void MEDSFile::getPSFs(std::vector<BVec>& psf_list, long i, long& flag) const
 
         // Get the interpolated BVec
         BVec psf = (*_fitpsf[meds_get_source_file_id(_medsPtr, i, j)])(cen);
+        psf_list.push_back(psf);
     }
 }
 
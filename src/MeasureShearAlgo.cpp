@@ -1,4 +1,5 @@
 
+#include <memory>
 #include "Params.h"
 #include "MeasureShearAlgo.h"
 #include "BVec.h"
@@ -21,7 +22,7 @@ void MeasureSingleShear(
     int& galorder, const ConfigFile& params,
     ShearLog& log, BVec& shapelet, 
     std::complex<double>& gamma, DSmallMatrix22& cov,
-    double& nu, long& flag)
+    double& nu, long& flag, CounterRng* rng)
 {
     double gal_aperture = params.read("shear_aperture",3.);
     double max_aperture = params.read("shear_max_aperture",0.);
@@ -37,6 +38,7 @@ void MeasureSingleShear(
     bool fixcen = params.read("shear_fix_centroid",false);
     bool fixsigma = params.keyExists("shear_force_sigma");
     double fixsigma_value = params.read("shear_force_sigma",0.);
+    double incremental_psi = params.read("shear_incremental_psi",0.);
     bool use_fake_pixels = params.read("shear_use_fake_pixels",false);
     double shear_inner_fake_aperture = params.read("shear_inner_fake_aperture",gal_aperture);
     double shear_outer_fake_aperture = params.read("shear_outer_fake_aperture",1.e100);
@@ -44,6 +46,11 @@ void MeasureSingleShear(
     double outer_fake_ap = 0.;
 
     try {
+        // All the pixel lists made here are only needed for this galaxy,
+        // so take them from this thread's arena, which is reset when 
+        // arena_scope goes out of scope.
+        ArenaScope arena_scope;
+
         dbg<<"Start MeasureSingleShear\n";
         dbg<<"allpix.size = "<<allpix.size()<<std::endl;
         const int nexp = allpix.size();
@@ -90,6 +97,7 @@ void MeasureSingleShear(
         // Load pixels from main PixelLists.
         //
         std::vector<PixelList> pix(nexp);
+        for(int i=0;i<nexp;++i) pix[i].useArena();
         int npix = 0;
         for(int i=0;i<nexp;++i) {
             if (use_fake_pixels) {
@@ -181,10 +189,16 @@ void MeasureSingleShear(
             // the centroid.  This is all pretty fast, so it's worth doing to
             // avoid the subtle bias that can otherwise result.
             // get an offset of 0.1 arcsec in a random direction.
+            // If rng is given, use that rather than rand().
             double x_offset, y_offset, rsq_offset;
             do {
-                x_offset = double(rand())*2./double(RAND_MAX) - 1.;
-                y_offset = double(rand())*2./double(RAND_MAX) - 1.;
+                if (rng) {
+                    x_offset = (*rng)()*2. - 1.;
+                    y_offset = (*rng)()*2. - 1.;
+                } else {
+                    x_offset = double(rand())*2./double(RAND_MAX) - 1.;
+                    y_offset = double(rand())*2./double(RAND_MAX) - 1.;
+                }
                 rsq_offset = x_offset*x_offset + y_offset*y_offset;
             } while (rsq_offset > 1. || rsq_offset == 0.);
             double r_offset = sqrt(rsq_offset);
@@ -440,6 +454,21 @@ void MeasureSingleShear(
 
         if (params.read("shear_native_only",false)) return;
 
+        // The pixels don't change from here on, but they are measured 
+        // many times below, so switch to the column-oriented version.
+        std::vector<PixelColumns> pixcols(nexp);
+        for(int i=0;i<nexp;++i) {
+            pixcols[i].useArena();
+            pixcols[i].assign(pix[i]);
+        }
+
+        // The psf-deconvolved measurements below use nearly the same
+        // frame each time, so the psi matrices can optionally be updated
+        // rather than rebuilt.  (See IncrementalPsi in Ellipse.h.)
+        std::auto_ptr<IncrementalPsi> inc;
+        if (incremental_psi > 0.) 
+            inc.reset(new IncrementalPsi(incremental_psi));
+
         // Start with the specified fPsf, but allow it to increase up to
         // max_fpsf if there are any problems.
         long flag0 = flag;
@@ -479,7 +508,8 @@ void MeasureSingleShear(
             shapelet.setSigma(sigma);
             DMatrix shapeCov(int(shapelet.size()),int(shapelet.size()));
             if (ell_native.measureShapelet(
-                    pix,psf,shapelet,galorder,galorder2,galorder,&shapeCov)) {
+                    pixcols,psf,shapelet,galorder,galorder2,galorder,
+                    &shapeCov)) {
                 dbg<<"Successful deconvolving fit:\n";
                 ++log._ns_mu;
             } else {
@@ -516,6 +546,7 @@ void MeasureSingleShear(
                 if (fixcen) ell_shear.fixCen();
                 if (fixsigma) ell_shear.fixMu();
                 //ell_shear.fixMu();
+                ell_shear.setIncrementalPsi(inc.get());
                 double w = sqrt(sigma/sigma_p);
                 bool success = false;
                 cov.setZero();
@@ -526,12 +557,17 @@ void MeasureSingleShear(
                     ell_meas.setGamma(
                         (w*ell_shear.getGamma() + ell_round.getGamma())/(w+1.));
                     if (ell_shear.measure(
-                            pix,psf,try_order,galorder2,maxm,sigma,flag1,
+                            pixcols,psf,try_order,galorder2,maxm,sigma,flag1,
                             1.e-2,&cov,&ell_meas)) {
                         dbg<<"Successful shear fit:\n";
                         dbg<<"Z = "<<ell_shear.getCen()<<std::endl;
                         dbg<<"Mu = "<<ell_shear.getMu()<<std::endl;
                         dbg<<"Gamma = "<<ell_shear.getGamma()<<std::endl;
+                        if (inc.get()) {
+                            dbg<<"Incremental psi: "<<inc->getNUpdates()<<
+                                " updates, "<<inc->getNRebuilds()<<
+                                " rebuilds\n";
+                        }
                     } else {
                         dbg<<"Shear measurement failed\n";
                         success = false;
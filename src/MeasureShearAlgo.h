@@ -7,14 +7,20 @@
 #include "BVec.h"
 #include "Log.h"
 #include "Pixel.h"
+#include "CounterRng.h"
 
+// If rng is given, it is used for the random offsets of the centroid.
+// The callers use this when shear_deterministic is set, giving each 
+// galaxy a CounterRng keyed by (shear_random_seed, id), so the results 
+// don't depend on the number of threads or the order of the galaxies.
+// Otherwise rand() is used.
 void MeasureSingleShear(
     const std::vector<PixelList>& allpix,
     const std::vector<BVec>& psf,
     int& galorder, const ConfigFile& params,
     ShearLog& log, BVec& shapelet, 
     std::complex<double>& gamma, DSmallMatrix22& cov,
-    double& nu, long& flag);
+    double& nu, long& flag, CounterRng* rng=0);
 
 #endif
 
@@ -89,6 +89,45 @@ std::vector<Bounds> MultiShearCatalog::splitBounds()
     return _skybounds.divide(nx,ny);
 }
 
+// The Transformation and FittedPSF constructors get the name
+// information from the parameter file, so we use that to set the 
+// names of each component image here.
+void MultiShearCatalog::setImageParams(ConfigFile& params, int ifile) const
+{
+    // Get the file names
+    Assert(ifile < int(_image_file_list.size()));
+    Assert(ifile < int(_fitpsf_file_list.size()));
+    std::string image_file = _image_file_list[ifile];
+    std::string fitpsf_file = _fitpsf_file_list[ifile];
+
+    dbg<<"Image file "<<ifile<<" = "<<image_file<<"\n";
+    // Set the appropriate parameters
+    params["image_file"] = image_file;
+    SetRoot(params,image_file);
+    params["fitpsf_file"] = fitpsf_file;
+
+    if (_shear_file_list.size() > 0) {
+        Assert(ifile < int(_shear_file_list.size()));
+        std::string shear_file = _shear_file_list[ifile];
+        params["shear_file"] = shear_file;
+    }
+
+    if (_skymap_file_list.size() > 0) {
+        Assert(ifile < int(_skymap_file_list.size()));
+        std::string skymap_file = _skymap_file_list[ifile];
+        params["skymap_file"] = skymap_file;
+    }
+}
+
+const PositionGrid& MultiShearCatalog::getSkyPosGrid()
+{
+    // The size check catches the catalog being read in again.
+    if (!_skypos_grid || _skypos_grid->size() != int(_skypos.size())) {
+        _skypos_grid.reset(new PositionGrid(_skypos));
+    }
+    return *_skypos_grid;
+}
+
 bool MultiShearCatalog::getPixels(const Bounds& bounds)
 {
     // The pixlist object takes up a lot of memory, so at the start 
@@ -108,58 +147,27 @@ bool MultiShearCatalog::getPixels(const Bounds& bounds)
 
     bool des_qa = _params.read("des_qa",false); 
 
+    // If we have the pixels for this section from a previous run,
+    // we don't need to read any of the images.
+    bool use_cache = _params.keyExists("multishear_stamp_cache_dir");
+    if (use_cache && readStampCache(bounds)) {
+        dbg<<"Done getPixels (from stamp cache)\n";
+        return true;
+    }
+
     try {
         dbg<<"Start GetPixels for b = "<<bounds<<std::endl;
         memory_usage(dbgout);
         // Loop over the files and read pixel lists for each object.
-        // The Transformation and FittedPSF constructors get the name
-        // information from the parameter file, so we use that to set the 
-        // names of each component image here.
-        const int nfiles = _image_file_list.size();
-        for (int ifile=0; ifile<nfiles; ++ifile) {
-#ifdef ONLY_N_IMAGES
-            if (ifile >= ONLY_N_IMAGES) break;
-#endif
-            dbg<<"ifile = "<<ifile<<std::endl;
-
-            // Get the file names
-            Assert(ifile < int(_image_file_list.size()));
-            Assert(ifile < int(_fitpsf_file_list.size()));
-            std::string image_file = _image_file_list[ifile];
-            std::string fitpsf_file = _fitpsf_file_list[ifile];
-
-            dbg<<"Reading image file: "<<image_file<<"\n";
-            // Set the appropriate parameters
-            _params["image_file"] = image_file;
-            SetRoot(_params,image_file);
-            _params["fitpsf_file"] = fitpsf_file;
-
-            if (_shear_file_list.size() > 0) {
-                Assert(ifile < int(_shear_file_list.size()));
-                std::string shear_file = _shear_file_list[ifile];
-                _params["shear_file"] = shear_file;
-            }
-
-            if (_skymap_file_list.size() > 0) {
-                Assert(ifile < int(_skymap_file_list.size()));
-                std::string skymap_file = _skymap_file_list[ifile];
-                _params["skymap_file"] = skymap_file;
-            }
-
-            // Load the pixels
-            dbg<<"Before load pixels for file "<<ifile<<
-                ": memory_usage = "<<memory_usage()<<std::endl;
-            if (!getImagePixelLists(ifile,bounds)) {
-                for (int i=0;i<nPix;++i) {
-                    _pix_list[i].clear();
-                    _psf_list[i].clear();
-                }
-                PixelList::reclaimMemory();
-                return false;
+        if (!getAllImagePixelLists(bounds)) {
+            for (int i=0;i<nPix;++i) {
+                _pix_list[i].clear();
+                _psf_list[i].clear();
             }
-            dbg<<"After load pixels for file "<<ifile<<
-                ": memory_usage = "<<memory_usage()<<std::endl;
+            PixelList::reclaimMemory();
+            return false;
         }
+        if (use_cache) writeStampCache(bounds);
     } catch (std::bad_alloc) {
         dbg<<"Caught bad_alloc\n";
         double mem = memory_usage(dbgout);
@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include "MyMatrix.h"
+#include "boost/shared_ptr.hpp"
 
 #include "dbg.h"
 #include "CoaddCatalog.h"
@@ -14,6 +15,9 @@
 #include "Transformation.h"
 #include "FittedPsf.h"
 #include "MEDSFile.h"
+#include "PositionGrid.h"
+
+struct SEImageData;
 
 class MultiShearCatalog 
 {
@@ -90,6 +94,25 @@ public :
 
 private :
 
+    // Helpers for getPixels
+    void setImageParams(ConfigFile& params, int ifile) const;
+    void loadImageData(SEImageData& data, const Bounds& b);
+    bool getAllImagePixelLists(const Bounds& b);
+    bool getImagePixelLists(
+        const std::vector<boost::shared_ptr<SEImageData> >& images,
+        const std::vector<boost::shared_ptr<SEImageData> >& next_images,
+        const Bounds& b);
+
+    // An index of _skypos, made when it is first needed.
+    const PositionGrid& getSkyPosGrid();
+
+    // The optional cache of the results of getPixels.
+    // See MultiShearCatalog_cache.cpp.
+    unsigned long long getStampCacheHash(const Bounds& b) const;
+    std::string getStampCacheName(unsigned long long hash) const;
+    bool readStampCache(const Bounds& b);
+    void writeStampCache(const Bounds& b) const;
+
     // flags related to i/o and psf interpolation
     std::vector<long> _input_flags;
 
@@ -135,6 +158,8 @@ private :
     std::vector<std::string> _fitpsf_file_list;
     std::vector<std::string> _skymap_file_list;
     std::vector<Bounds> _saved_se_skybounds;
+
+    boost::shared_ptr<PositionGrid> _skypos_grid;
 };
 
 #endif
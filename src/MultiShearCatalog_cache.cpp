@@ -0,0 +1,458 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "MultiShearCatalog.h"
+#include "ConfigFile.h"
+#include "Params.h"
+#include "Name.h"
+
+// The stamp cache saves the results of getPixels for each section,
+// so that later runs of multishear on the same inputs (with different
+// shear measurement parameters, say) can skip reading all of the
+// single-epoch images.
+//
+// There is one file for each section, named by a hash of the input
+// files, the parameters that affect the pixels, the coadd catalog and
+// the section bounds.  So any change to these just means the old file
+// is not found, and a new one is written.  The hash is also stored in
+// the file and checked when it is read.
+//
+// The file layout is (all values in native byte order):
+//
+//   char[8]   magic = "WLSTAMP"
+//   int32     version
+//   int32     (unused)
+//   uint64    hash
+//   int64     ngals  (the number of galaxies in the file)
+//   int64     offset[ngals]  (the file position of each galaxy record)
+//
+// followed by a record for each galaxy:
+//
+//   int64     index  (the index in the coadd catalog)
+//   int64     input_flags
+//   int32     nimages_found
+//   int32     nimages_gotpix
+//   int32     nepoch
+//   int32     (unused)
+//
+// and for each epoch:
+//
+//   int32     se_num
+//   int32     psf_order
+//   double    se_pos x, y
+//   double    psf sigma
+//   double    psf[(psf_order+1)*(psf_order+2)/2]
+//   int64     npix
+//   double    u, v, flux, inverse_sigma  (for each pixel)
+//
+// Every field is 8-byte aligned, so the file can be mmap'ed and read
+// in place.
+
+static const char stamp_cache_magic[8] = "WLSTAMP";
+static const int stamp_cache_version = 1;
+
+// The parameters that affect the pixel lists or which images are used.
+static const char* stamp_cache_keys[] = {
+    "image_ext", "image_hdu", "image_prefix", "image_gain", "image_gain_key",
+    "image_extra_sky", "image_readnoise", "image_readnoise_key",
+    "weight_ext", "weight_hdu", "weight_prefix",
+    "badpix_ext", "badpix_hdu", "badpix_prefix",
+    "skymap_ext", "skymap_hdu", "skymap_prefix",
+    "dist_method", "dist_ext", "dist_hdu", "dist_prefix",
+    "pixel_scale", "dudx", "dudy", "dvdx", "dvdy",
+    "fitpsf_ext", "fitpsf_hdu", "fitpsf_io", "fitpsf_prefix",
+    "fitpsf_grid_spacing", "fitpsf_grid_method", "fitpsf_grid_max_error",
+    "shear_ext", "shear_hdu", "shear_io", "shear_prefix", "shear_delim",
+    "shear_aperture", "shear_max_aperture",
+    "cat_x_offset", "cat_y_offset", "ignore_edges",
+    "noise", "noise_method", "input_prefix",
+    "multishear_sky_method", "multishear_require_match",
+    "multishear_inverse_order", "multishear_inverse_max_error",
+    0 };
+
+// 64 bit FNV-1a hash
+static const unsigned long long fnv_offset = 14695981039346656037ULL;
+static const unsigned long long fnv_prime = 1099511628211ULL;
+
+static void HashBytes(unsigned long long& hash, const void* p, size_t n)
+{
+    const unsigned char* c = static_cast<const unsigned char*>(p);
+    for(size_t k=0;k<n;++k) {
+        hash ^= c[k];
+        hash *= fnv_prime;
+    }
+}
+
+static void HashString(unsigned long long& hash, const std::string& s)
+{
+    HashBytes(hash,s.c_str(),s.size()+1);
+}
+
+template <typename T>
+static void HashValue(unsigned long long& hash, const T& x)
+{ HashBytes(hash,&x,sizeof(T)); }
+
+// Hash the name, size and modification time of a file.
+static void HashFile(unsigned long long& hash, const std::string& name)
+{
+    HashString(hash,name);
+    struct stat st;
+    if (stat(name.c_str(),&st) == 0) {
+        HashValue(hash,(long long)st.st_size);
+        HashValue(hash,(long long)st.st_mtime);
+    }
+}
+
+unsigned long long MultiShearCatalog::getStampCacheHash(
+    const Bounds& bounds) const
+{
+    unsigned long long hash = fnv_offset;
+    HashValue(hash,stamp_cache_version);
+
+    // The section
+    HashValue(hash,bounds.getXMin());
+    HashValue(hash,bounds.getXMax());
+    HashValue(hash,bounds.getYMin());
+    HashValue(hash,bounds.getYMax());
+
+    // The coadd catalog
+    const int ngals = size();
+    HashValue(hash,ngals);
+    for(int i=0;i<ngals;++i) {
+        HashValue(hash,_id[i]);
+        HashValue(hash,_skypos[i].getX());
+        HashValue(hash,_skypos[i].getY());
+        HashValue(hash,_flags[i]);
+    }
+
+    // The parameters
+    for(int k=0; stamp_cache_keys[k]; ++k) {
+        std::string key = stamp_cache_keys[k];
+        HashString(hash,key);
+        if (_params.keyExists(key)) {
+            std::string value = _params.get(key);
+            HashString(hash,value);
+        }
+    }
+
+    // The input files.
+    const int nfiles = _image_file_list.size();
+    HashValue(hash,nfiles);
+    for(int k=0;k<nfiles;++k) HashFile(hash,_image_file_list[k]);
+    for(size_t k=0;k<_fitpsf_file_list.size();++k)
+        HashFile(hash,_fitpsf_file_list[k]);
+    for(size_t k=0;k<_shear_file_list.size();++k)
+        HashFile(hash,_shear_file_list[k]);
+    for(size_t k=0;k<_skymap_file_list.size();++k)
+        HashFile(hash,_skymap_file_list[k]);
+
+    // The weight and badpix images are often other hdus of the image
+    // file, but when they are separate files, they need to be checked
+    // too.  Their names come from each image's parameters, the same
+    // way Image finds them.
+    bool use_weight = _params.keyExists("noise_method") &&
+        _params["noise_method"] == "WEIGHT_IMAGE";
+    bool use_badpix = use_weight && (
+        _params.keyExists("badpix_file") || _params.keyExists("badpix_ext"));
+    if (use_weight) {
+        ConfigFile params = _params;
+        for(int k=0;k<nfiles;++k) {
+            setImageParams(params,k);
+            try {
+                std::string weight_name = MakeName(params,"weight",true,true);
+                if (weight_name != _image_file_list[k]) 
+                    HashFile(hash,weight_name);
+                if (use_badpix) {
+                    std::string badpix_name = 
+                        MakeName(params,"badpix",true,true);
+                    if (badpix_name != _image_file_list[k] && 
+                        badpix_name != weight_name)
+                        HashFile(hash,badpix_name);
+                }
+            } catch (std::exception& e) {
+                // A missing file will fail in getPixels anyway.
+                // Just hash the fact that it was missing.
+                xdbg<<"Error finding weight or badpix for file "<<k<<
+                    ": "<<e.what()<<std::endl;
+                HashValue(hash,k);
+            }
+        }
+    }
+
+    return hash;
+}
+
+std::string MultiShearCatalog::getStampCacheName(
+    unsigned long long hash) const
+{
+    std::string dir = _params.get("multishear_stamp_cache_dir");
+    std::ostringstream name;
+    name << dir << "/stamps_" << std::hex << std::setfill('0') <<
+        std::setw(16) << hash << ".dat";
+    return name.str();
+}
+
+template <typename T>
+static void WriteValue(std::FILE* fp, const T& x)
+{
+    if (std::fwrite(&x,sizeof(T),1,fp) != 1)
+        throw WriteException("Error writing stamp cache");
+}
+
+template <typename T>
+static T ReadValue(const char*& p, const char* end)
+{
+    if (p + sizeof(T) > end)
+        throw ReadException("Stamp cache file is truncated");
+    T x;
+    std::memcpy(&x,p,sizeof(T));
+    p += sizeof(T);
+    return x;
+}
+
+void MultiShearCatalog::writeStampCache(const Bounds& bounds) const
+{
+    unsigned long long hash = getStampCacheHash(bounds);
+    std::string file = getStampCacheName(hash);
+    dbg<<"Writing stamp cache "<<file<<std::endl;
+
+    // The galaxies in this section
+    std::vector<long long> index;
+    const int ngals = size();
+    for(int i=0;i<ngals;++i) {
+        if (_flags[i]) continue;
+        if (!bounds.includes(_skypos[i])) continue;
+        index.push_back(i);
+    }
+    const long long ncache = index.size();
+
+    // Write to a temporary file, and then rename it, so another job
+    // never sees a partially written file.  The temporary name is unique
+    // (from mkstemp), so two jobs writing the same section at once each
+    // write their own file, and the last rename wins.
+    std::string tmp_file = file + ".XXXXXX";
+    std::vector<char> tmp_name(tmp_file.begin(),tmp_file.end());
+    tmp_name.push_back('\0');
+    int fd = mkstemp(&tmp_name[0]);
+    std::FILE* fp = 0;
+    if (fd >= 0) {
+        tmp_file = &tmp_name[0];
+        // mkstemp makes the file readable only by us.
+        fchmod(fd,0644);
+        fp = fdopen(fd,"wb");
+        if (!fp) {
+            close(fd);
+            std::remove(tmp_file.c_str());
+        }
+    }
+    if (!fp) {
+        // Not fatal.  We just won't have a cache for this section.
+        dbg<<"Unable to open "<<tmp_file<<" for writing\n";
+        return;
+    }
+    try {
+        std::fwrite(stamp_cache_magic,1,8,fp);
+        WriteValue(fp,int(stamp_cache_version));
+        WriteValue(fp,int(0));
+        WriteValue(fp,hash);
+        WriteValue(fp,ncache);
+
+        // Work out the offset of each record.
+        long long offset = 32 + ncache * 8;
+        for(long long k=0;k<ncache;++k) {
+            WriteValue(fp,offset);
+            const int i = index[k];
+            offset += 32;
+            const int nepoch = _pix_list[i].size();
+            for(int j=0;j<nepoch;++j) {
+                offset += 32 + _psf_list[i][j].size() * 8;
+                offset += 8 + _pix_list[i][j].size() * 32;
+            }
+        }
+
+        for(long long k=0;k<ncache;++k) {
+            const int i = index[k];
+            const int nepoch = _pix_list[i].size();
+            Assert(int(_psf_list[i].size()) == nepoch);
+            Assert(int(_se_num[i].size()) == nepoch);
+            Assert(int(_se_pos[i].size()) == nepoch);
+            WriteValue(fp,index[k]);
+            WriteValue(fp,(long long)_input_flags[i]);
+            WriteValue(fp,_nimages_found[i]);
+            WriteValue(fp,_nimages_gotpix[i]);
+            WriteValue(fp,nepoch);
+            WriteValue(fp,int(0));
+            for(int j=0;j<nepoch;++j) {
+                const BVec& psf = _psf_list[i][j];
+                WriteValue(fp,_se_num[i][j]);
+                WriteValue(fp,psf.getOrder());
+                WriteValue(fp,_se_pos[i][j].getX());
+                WriteValue(fp,_se_pos[i][j].getY());
+                WriteValue(fp,psf.getSigma());
+                const int psfsize = psf.size();
+                for(int m=0;m<psfsize;++m) WriteValue(fp,double(psf(m)));
+                const PixelList& pix = _pix_list[i][j];
+                const long long npix = pix.size();
+                WriteValue(fp,npix);
+                for(long long n=0;n<npix;++n) {
+                    WriteValue(fp,real(pix[n].getPos()));
+                    WriteValue(fp,imag(pix[n].getPos()));
+                    WriteValue(fp,pix[n].getFlux());
+                    WriteValue(fp,pix[n].getInverseSigma());
+                }
+            }
+        }
+    } catch (WriteException& e) {
+        dbg<<e.what()<<std::endl;
+        std::fclose(fp);
+        std::remove(tmp_file.c_str());
+        return;
+    }
+    if (std::fclose(fp) != 0 ||
+        std::rename(tmp_file.c_str(),file.c_str()) != 0) {
+        dbg<<"Error finishing stamp cache file "<<file<<std::endl;
+        std::remove(tmp_file.c_str());
+        return;
+    }
+    dbg<<"Wrote "<<ncache<<" galaxies to stamp cache\n";
+}
+
+bool MultiShearCatalog::readStampCache(const Bounds& bounds)
+{
+    unsigned long long hash = getStampCacheHash(bounds);
+    std::string file = getStampCacheName(hash);
+    dbg<<"Looking for stamp cache "<<file<<std::endl;
+
+    int fd = open(file.c_str(),O_RDONLY);
+    if (fd < 0) {
+        dbg<<"Not found.\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd,&st) != 0 || st.st_size < 32) {
+        close(fd);
+        return false;
+    }
+    const size_t len = st.st_size;
+    void* map = mmap(0,len,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        dbg<<"mmap failed\n";
+        return false;
+    }
+    const char*const begin = static_cast<const char*>(map);
+    const char*const end = begin + len;
+
+    bool ok = false;
+    try {
+        const char* p = begin;
+        if (std::memcmp(p,stamp_cache_magic,8) != 0)
+            throw ReadException("Stamp cache has wrong magic number");
+        p += 8;
+        int version = ReadValue<int>(p,end);
+        ReadValue<int>(p,end);
+        if (version != stamp_cache_version)
+            throw ReadException("Stamp cache has wrong version");
+        unsigned long long file_hash = ReadValue<unsigned long long>(p,end);
+        if (file_hash != hash)
+            throw ReadException("Stamp cache has wrong hash");
+        const long long ncache = ReadValue<long long>(p,end);
+        if (ncache < 0 || ncache > (long long)((len-32)/8))
+            throw ReadException("Stamp cache has invalid count");
+        const char* offsets = p;
+        // Records start after the offset table.
+        const long long first_record = 32 + 8*ncache;
+
+        const int ngals = size();
+        for(long long k=0;k<ncache;++k) {
+            const char* q = offsets + k*8;
+            long long offset = ReadValue<long long>(q,end);
+            // The fixed part of the record is 32 bytes.
+            if (offset < first_record || offset > (long long)len - 32)
+                throw ReadException("Stamp cache has invalid offset");
+            p = begin + offset;
+            const long long i = ReadValue<long long>(p,end);
+            if (i < 0 || i >= ngals)
+                throw ReadException("Stamp cache has invalid index");
+            _input_flags[i] = ReadValue<long long>(p,end);
+            _nimages_found[i] = ReadValue<int>(p,end);
+            _nimages_gotpix[i] = ReadValue<int>(p,end);
+            const int nepoch = ReadValue<int>(p,end);
+            ReadValue<int>(p,end);
+            // Each epoch takes at least 48 bytes.
+            if (nepoch < 0 || nepoch > (end-p)/48)
+                throw ReadException("Stamp cache has invalid nepoch");
+
+            _pix_list[i].resize(nepoch);
+            _psf_list[i].clear();
+            _psf_list[i].reserve(nepoch);
+            _se_num[i].resize(nepoch);
+            _se_pos[i].resize(nepoch);
+            for(int j=0;j<nepoch;++j) {
+                _se_num[i][j] = ReadValue<int>(p,end);
+                const int psforder = ReadValue<int>(p,end);
+                const double x = ReadValue<double>(p,end);
+                const double y = ReadValue<double>(p,end);
+                _se_pos[i][j] = Position(x,y);
+                const double sigma = ReadValue<double>(p,end);
+                if (psforder < 0 || 
+                    (long long)(psforder+1)*(psforder+2)/2 > (end-p)/8)
+                    throw ReadException("Stamp cache has invalid psf_order");
+                BVec psf(psforder,sigma);
+                const int psfsize = psf.size();
+                for(int m=0;m<psfsize;++m) psf(m) = ReadValue<double>(p,end);
+                _psf_list[i].push_back(psf);
+
+                // The PixelList owns its storage (in the pool), so the
+                // pixels are copied out of the mapped file here.
+                const long long npix = ReadValue<long long>(p,end);
+                if (npix < 0 || npix > (end-p)/32)
+                    throw ReadException("Stamp cache file is truncated");
+                PixelList& pix = _pix_list[i][j];
+                pix = PixelList();
+#ifdef PIXELLIST_BLOCK
+                pix.usePool();
+#endif
+                pix.reserve(npix);
+                for(long long n=0;n<npix;++n) {
+                    const double u = ReadValue<double>(p,end);
+                    const double v = ReadValue<double>(p,end);
+                    const double flux = ReadValue<double>(p,end);
+                    const double inv_sigma = ReadValue<double>(p,end);
+                    pix.push_back(Pixel(u,v,flux,inv_sigma));
+                }
+            }
+        }
+        dbg<<"Read "<<ncache<<" galaxies from stamp cache\n";
+        ok = true;
+    } catch (ReadException& e) {
+        dbg<<"Error reading stamp cache: "<<e.what()<<std::endl;
+    }
+    munmap(map,len);
+
+    if (!ok) {
+        // Don't leave a partial section behind.
+        const int ngals = size();
+        for (int i=0;i<ngals;++i) {
+            if (!bounds.includes(_skypos[i])) continue;
+            _pix_list[i].clear();
+            _psf_list[i].clear();
+            _se_num[i].clear();
+            _se_pos[i].clear();
+            _input_flags[i] = 0;
+            _nimages_found[i] = 0;
+            _nimages_gotpix[i] = 0;
+        }
+    }
+    return ok;
+}
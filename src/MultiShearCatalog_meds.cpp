@@ -5,6 +5,50 @@
 #include "Log.h"
 #include "MeasureShearAlgo.h"
 
+// The pixels and psfs for a batch of galaxies, read ahead of time 
+// from the MEDS file.
+struct MEDSBatch
+{
+    std::vector<int> index;
+    std::vector<std::vector<PixelList> > pix;
+    std::vector<std::vector<BVec> > psf;
+
+    int size() const { return index.size(); }
+    void clear() { index.clear(); pix.clear(); psf.clear(); }
+    void swap(MEDSBatch& rhs) 
+    { index.swap(rhs.index); pix.swap(rhs.pix); psf.swap(rhs.psf); }
+};
+
+// Read the next batch of galaxies, starting at next.  Stop when there are
+// max_ngal galaxies in the batch, or when the pixels take up more than 
+// max_mem MB.  On output, next is the first galaxy that hasn't been read.
+static void ReadMEDSBatch(
+    const MEDSFile& meds, std::vector<long>& flags, int& next, int ngals,
+    int max_ngal, double max_mem, MEDSBatch& batch)
+{
+    batch.clear();
+    double mem = 0.;
+    for(; next<ngals && batch.size()<max_ngal && mem<max_mem; ++next) {
+        const int i = next;
+        if (flags[i]) continue;
+#ifdef STARTAT
+        if (i < STARTAT) continue;
+#endif
+#ifdef SINGLEGAL
+        if (i != SINGLEGAL) continue;
+#endif
+        batch.index.push_back(i);
+        batch.pix.push_back(std::vector<PixelList>());
+        batch.psf.push_back(std::vector<BVec>());
+        meds.getPixels(batch.pix.back(),i,flags[i]);
+        meds.getPSFs(batch.psf.back(),i,flags[i]);
+        const int nepoch = batch.pix.back().size();
+        for(int k=0;k<nepoch;++k) 
+            mem += batch.pix.back()[k].size() * sizeof(Pixel) / (1024.*1024.);
+    }
+    dbg<<"Read batch of "<<batch.size()<<" galaxies, "<<mem<<" MB\n";
+}
+
 int MultiShearCatalog::measureMEDS(const MEDSFile& meds, ShearLog& log)
 {
     dbg<<"Start MeasureMEDS\n";
@@ -16,6 +60,17 @@ int MultiShearCatalog::measureMEDS(const MEDSFile& meds, ShearLog& log)
 #ifdef _OPENMP
     bool des_qa = _params.read("des_qa",false); 
 #endif
+    bool deterministic = _params.read("shear_deterministic",false);
+    unsigned long seed = _params.read("shear_random_seed",0UL);
+
+    // The galaxies are read in batches of at most this many galaxies
+    // and this much memory (in MB).  One thread reads the next batch
+    // while the others measure the current one, so up to twice this 
+    // is in memory at once.
+    int batch_ngal = _params.read("meds_prefetch_ngal",1000);
+    double batch_mem = _params.read("meds_prefetch_max_mem",500.);
+    Assert(batch_ngal > 0);
+    Assert(batch_mem > 0.);
 
     int nSuccess = 0;
 
@@ -23,102 +78,126 @@ int MultiShearCatalog::measureMEDS(const MEDSFile& meds, ShearLog& log)
     ngals = ENDAT;
 #endif
 
+    MEDSBatch batch, next_batch;
+    int next = 0;
+    ReadMEDSBatch(meds,_flags,next,ngals,batch_ngal,batch_mem,batch);
+
     // Main loop to measure shears
+    while (batch.size() > 0) {
+        const int nbatch = batch.size();
 #ifdef _OPENMP
 #pragma omp parallel 
-    {
-        try {
+        {
+            try {
 #endif
-            ShearLog log1(_params); // just for this thread
-            log1.noWriteLog();
+                ShearLog log1(_params); // just for this thread
+                log1.noWriteLog();
+
+                // One thread reads the next batch, and then joins the 
+                // others in the loop below.  Since the loop is dynamically
+                // scheduled, the others don't wait for it.  
+                // This also means that only one thread at a time uses
+                // the MEDS file, which isn't thread safe.
 #ifdef _OPENMP
-#pragma omp for schedule(dynamic)
-#endif
-            for(int i=0;i<ngals;++i) {
-                if (_flags[i]) continue;
-#ifdef STARTAT
-                if (i < STARTAT) continue;
-#endif
-#ifdef SINGLEGAL
-                if (i < SINGLEGAL) continue;
-                if (i > SINGLEGAL) break;
+#pragma omp single nowait
 #endif
+                {
+                    ReadMEDSBatch(
+                        meds,_flags,next,ngals,batch_ngal,batch_mem,
+                        next_batch);
+                }
 
-                if (output_dots) {
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+                for(int ib=0;ib<nbatch;++ib) {
+                    const int i = batch.index[ib];
+                    if (output_dots) {
 #ifdef _OPENMP
 #pragma omp critical (output)
 #endif
-                    {
-                        std::cerr<<"."; std::cerr.flush(); 
+                        {
+                            std::cerr<<"."; std::cerr.flush(); 
+                        }
                     }
-                }
-                dbg<<"galaxy "<<i<<":\n";
-                dbg<<"id = "<<_id[i]<<std::endl;
-                dbg<<"chippos = "<<_chippos[i]<<std::endl;
-                dbg<<"skypos = "<<_skypos[i]<<std::endl;
-
-                // Get the pixels and PSFs from the MEDS file.
-                std::vector<PixelList> pix_list;
-                meds.getPixels(pix_list,i,_flags[i]);
-                std::vector<BVec> psf_list;
-                meds.getPSFs(psf_list,i,_flags[i]);
-                dbg<<"Using "<<pix_list.size()<<" epochs\n";
-                Assert(pix_list.size() == psf_list.size());
+                    dbg<<"galaxy "<<i<<":\n";
+                    dbg<<"id = "<<_id[i]<<std::endl;
+                    dbg<<"chippos = "<<_chippos[i]<<std::endl;
+                    dbg<<"skypos = "<<_skypos[i]<<std::endl;
+
+                    // The pixels and PSFs were already read from the 
+                    // MEDS file.
+                    std::vector<PixelList>& pix_list = batch.pix[ib];
+                    std::vector<BVec>& psf_list = batch.psf[ib];
+                    dbg<<"Using "<<pix_list.size()<<" epochs\n";
+                    Assert(pix_list.size() == psf_list.size());
 
 #if 1
-                MeasureSingleShear(
-                    // Input data:
-                    pix_list, psf_list,
-                    // Parameters:
-                    _meas_galorder[i], _params,
-                    // Log information
-                    log1,
-                    // Ouput values:
-                    _shape[i], _shear[i], _cov[i], _nu[i], _flags[i]);
+                    CounterRng rng(seed,_id[i]);
+                    MeasureSingleShear(
+                        // Input data:
+                        pix_list, psf_list,
+                        // Parameters:
+                        _meas_galorder[i], _params,
+                        // Log information
+                        log1,
+                        // Ouput values:
+                        _shape[i], _shear[i], _cov[i], _nu[i], _flags[i],
+                        deterministic ? &rng : 0);
 #else
-                _meas_galorder[i] = 0;
-                _shear[i] = std::complex<double>(0.1,0.2);
-                _cov[i] << 1., 0., 0., 1.;
-                _shape[i].vec().setZero();
-                _nu[i] = 10.;
+                    _meas_galorder[i] = 0;
+                    _shear[i] = std::complex<double>(0.1,0.2);
+                    _cov[i] << 1., 0., 0., 1.;
+                    _shape[i].vec().setZero();
+                    _nu[i] = 10.;
 #endif
 
-                if (!_flags[i]) {
-                    dbg<<"Successful shear measurements: \n";
-                    dbg<<"shape = "<<_shape[i]<<std::endl;
-                    dbg<<"shear = "<<_shear[i]<<std::endl;
-                    dbg<<"cov = "<<_cov[i]<<std::endl;
-                    dbg<<"nu = "<<_nu[i]<<std::endl;
-                    ++nSuccess;
-                } else {
-                    dbg<<"Unsuccessful shear measurement\n"; 
-                    dbg<<"flag = "<<_flags[i]<<std::endl;
+                    if (!_flags[i]) {
+                        dbg<<"Successful shear measurements: \n";
+                        dbg<<"shape = "<<_shape[i]<<std::endl;
+                        dbg<<"shear = "<<_shear[i]<<std::endl;
+                        dbg<<"cov = "<<_cov[i]<<std::endl;
+                        dbg<<"nu = "<<_nu[i]<<std::endl;
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+                        ++nSuccess;
+                    } else {
+                        dbg<<"Unsuccessful shear measurement\n"; 
+                        dbg<<"flag = "<<_flags[i]<<std::endl;
+                    }
+
+                    // Free the pixels as we go, rather than waiting 
+                    // for the whole batch.
+                    std::vector<PixelList>().swap(pix_list);
                 }
-            }
 #ifdef _OPENMP
 #pragma omp critical (add_log)
 #endif
-            {
-                log += log1;
-            }
+                {
+                    log += log1;
+                }
 #ifdef _OPENMP
-        } catch (std::exception& e) {
-            // This isn't supposed to happen.
-            if (des_qa) {
-                std::cerr<<"STATUS5BEG Caught error in parallel region STATUS5END\n";
-            } 
-            std::cerr<<"Caught "<<e.what()<<std::endl;
-            std::cerr<<"Caught error in parallel region.  Aborting.\n";
-            exit(1);
-        } catch (...) {
-            if (des_qa) {
-                std::cerr<<"STATUS5BEG Caught error in parallel region STATUS5END\n";
+            } catch (std::exception& e) {
+                // This isn't supposed to happen.
+                if (des_qa) {
+                    std::cerr<<"STATUS5BEG Caught error in parallel region STATUS5END\n";
+                } 
+                std::cerr<<"Caught "<<e.what()<<std::endl;
+                std::cerr<<"Caught error in parallel region.  Aborting.\n";
+                exit(1);
+            } catch (...) {
+                if (des_qa) {
+                    std::cerr<<"STATUS5BEG Caught error in parallel region STATUS5END\n";
+                }
+                std::cerr<<"Caught error in parallel region.  Aborting.\n";
+                exit(1);
             }
-            std::cerr<<"Caught error in parallel region.  Aborting.\n";
-            exit(1);
         }
-    }
 #endif
+        batch.clear();
+        batch.swap(next_batch);
+    }
 
     dbg<<nSuccess<<" successful shear measurements in this pass.\n";
     dbg<<log._ns_gamma<<" successful shear measurements so far.\n";
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include "MultiShearCatalog.h"
 #include "ConfigFile.h"
 #include "Params.h"
@@ -7,6 +8,44 @@
 #include "ShearCatalog.h"
 #include "ShearCatalogTree.h"
 #include "MeasureShearAlgo.h"
+#include "ImageTileCache.h"
+
+struct CostSorter
+{
+    const std::vector<double>& _cost;
+    CostSorter(const std::vector<double>& cost) : _cost(cost) {}
+    bool operator()(int i, int j) const { return _cost[i] > _cost[j]; }
+};
+
+struct HasFlag
+{
+    const std::vector<long>& _flags;
+    HasFlag(const std::vector<long>& flags) : _flags(flags) {}
+    bool operator()(int i) const { return _flags[i] != 0; }
+};
+
+// The time to measure a galaxy varies by a factor of 100 or more, mostly
+// according to the total number of pixels in all of its epochs.  
+// (The aperture for each epoch was already set from the size of the 
+// nearest single-epoch measurement when the pixels were read in.)
+// Sort the galaxy indices in order by decreasing cost, so the big ones
+// are started first, rather than a few of them being left running at 
+// the end while the other threads are idle.
+static void GetCostOrder(
+    const std::vector<std::vector<PixelList> >& pix_list,
+    std::vector<int>& order)
+{
+    const int ngals = pix_list.size();
+    std::vector<double> cost(ngals,0.);
+    const int norder = order.size();
+    for(int j=0;j<norder;++j) {
+        const int i = order[j];
+        const int nepoch = pix_list[i].size();
+        for(int k=0;k<nepoch;++k) cost[i] += pix_list[i][k].size();
+    }
+    // Use stable_sort so galaxies with equal cost stay in catalog order.
+    std::stable_sort(order.begin(),order.end(),CostSorter(cost));
+}
 
 int MultiShearCatalog::measureMultiShears(const Bounds& b, ShearLog& log)
 {
@@ -19,6 +58,8 @@ int MultiShearCatalog::measureMultiShears(const Bounds& b, ShearLog& log)
 #ifdef _OPENMP
     bool des_qa = _params.read("des_qa",false); 
 #endif
+    bool deterministic = _params.read("shear_deterministic",false);
+    unsigned long seed = _params.read("shear_random_seed",0UL);
 
     int nSuccess = 0;
 
@@ -26,6 +67,15 @@ int MultiShearCatalog::measureMultiShears(const Bounds& b, ShearLog& log)
     ngals = ENDAT;
 #endif
 
+    // Only the galaxies in b.
+    std::vector<int> order;
+    getSkyPosGrid().findInBounds(b,order);
+    order.erase(
+        std::lower_bound(order.begin(),order.end(),ngals),order.end());
+    GetCostOrder(_pix_list,order);
+    const int norder = order.size();
+    dbg<<norder<<" galaxies in bounds\n";
+
     // Main loop to measure shears
 #ifdef _OPENMP
 #pragma omp parallel 
@@ -37,15 +87,14 @@ int MultiShearCatalog::measureMultiShears(const Bounds& b, ShearLog& log)
 #ifdef _OPENMP
 #pragma omp for schedule(dynamic)
 #endif
-            for(int i=0;i<ngals;++i) {
-                if (!b.includes(_skypos[i])) continue;
+            for(int ii=0;ii<norder;++ii) {
+                const int i = order[ii];
                 if (_flags[i]) continue;
 #ifdef STARTAT
                 if (i < STARTAT) continue;
 #endif
 #ifdef SINGLEGAL
-                if (i < SINGLEGAL) continue;
-                if (i > SINGLEGAL) break;
+                if (i != SINGLEGAL) continue;
 #endif
 
                 if (output_dots) {
@@ -80,6 +129,7 @@ int MultiShearCatalog::measureMultiShears(const Bounds& b, ShearLog& log)
                 }
 
 #if 1
+                CounterRng rng(seed,_id[i]);
                 MeasureSingleShear(
                     // Input data:
                     _pix_list[i], _psf_list[i],
@@ -88,7 +138,8 @@ int MultiShearCatalog::measureMultiShears(const Bounds& b, ShearLog& log)
                     // Log information
                     log1,
                     // Ouput values:
-                    _shape[i], _shear[i], _cov[i], _nu[i], _flags[i]);
+                    _shape[i], _shear[i], _cov[i], _nu[i], _flags[i],
+                    deterministic ? &rng : 0);
 #else
                 _meas_galorder[i] = 0;
                 _shear[i] = std::complex<double>(0.1,0.2);
@@ -147,21 +198,66 @@ int MultiShearCatalog::measureMultiShears(const Bounds& b, ShearLog& log)
     return nSuccess;
 }
 
+// Find the positions in the single-epoch image of the objects at skypos.
+// found[i] is set to false if the position is off the part of the image 
+// where the psf is defined.
+// If polish is false, inv_trans is taken to be accurate enough as is.
+static void getImagePos(
+    const std::vector<Position>& skypos,
+    const Transformation& trans, const Transformation& inv_trans,
+    bool polish, const FittedPsf& fitpsf, 
+    std::vector<Position>& pos, std::vector<long>& input_flags,
+    std::vector<char>& found)
+{
+    const int n = skypos.size();
+    pos.resize(n);
+    input_flags.resize(n,0);
+    found.resize(n);
+
+    // Convert ra/dec to x,y in this image
+
+    // First, figure out a good starting point for the nonlinear solver:
+    inv_trans.transformMany(skypos,pos);
+
+    // Now do the full non-linear solver, which should be pretty fast
+    // given the decent initial guess.
+    if (polish) {
+        std::vector<Position> guess = pos;
+        std::vector<bool> success;
+        trans.inverseTransformMany(skypos,pos,success);
+        for(int i=0;i<n;++i) if (!success[i]) {
+            dbg << "InverseTransform failed for position "<<skypos[i]<<".\n";
+            dbg << "Initial guess was "<<guess[i]<<".\n";
+            input_flags[i] |= TRANSFORM_EXCEPTION;
+        }
+    }
+
+    for(int i=0;i<n;++i) {
+        xdbg<<"after exact InverseTransform: pos -> "<<pos[i]<<std::endl;
+        found[i] = fitpsf.getBounds().includes(pos[i]);
+        if (!found[i]) {
+            xdbg<<"Reject pos "<<pos[i]<<" not in fitpsf bounds ";
+            xdbg<<fitpsf.getBounds()<<std::endl;
+        }
+    }
+}
+
 static void getImagePixList(
     std::vector<PixelList>& pix_list,
     std::vector<BVec>& psf_list,
     std::vector<int>& se_num, std::vector<Position>& se_pos, int se_index,
-    long& input_flags, int& nimages_found, int& nimages_gotpix,
-    const Position& skypos,
-    const Image<double>& im,
+    long& input_flags, int& nimages_gotpix,
+    const Position& pos, const BVec& psf,
+    const Image<double>*const image,
     const Transformation& trans,
-    const Transformation& inv_trans,
-    BVec& psf, const FittedPsf& fitpsf,
     const ShearCatalog& shearcat,
     const ShearCatalogTree& shearcat_tree,
     const Image<double>*const weight_image,
     const double noise, const double mean_sky, 
     const Image<double>*const skymap,
+    const ImageTileCache<double>*const image_cache,
+    const ImageTileCache<double>*const weight_cache,
+    const ImageTileCache<double>*const badpix_cache,
     double gal_aperture, double max_aperture, const ConfigFile& params)
 {
     std::string sky_method = params.get("multishear_sky_method");
@@ -172,39 +268,6 @@ static void getImagePixList(
     Assert(se_num.size() == pix_list.size());
     Assert(se_pos.size() == pix_list.size());
 
-    // Convert ra/dec to x,y in this image
-
-    // First, figure out a good starting point for the nonlinear solver:
-    Position pos;
-    xdbg<<"skypos = "<<skypos<<std::endl;
-    inv_trans.transform(skypos,pos);
-    xdbg<<"invtrans(skypos) = "<<pos<<std::endl;
-
-    // Now do the full non-linear solver, which should be pretty fast
-    // given the decent initial guess.
-    if (!trans.inverseTransform(skypos, pos) ) {
-        dbg << "InverseTransform failed for position "<<skypos<<".\n";
-        dbg << "Initial guess was "<<pos<<".\n";
-        input_flags |= TRANSFORM_EXCEPTION;
-    }
-    xdbg<<"after exact InverseTransform: pos -> "<<pos<<std::endl;
-    if (!(fitpsf.getBounds().includes(pos))) {
-        xdbg<<"Reject pos "<<pos<<" not in fitpsf bounds ";
-        xdbg<<fitpsf.getBounds()<<std::endl;
-        return;
-    }
-
-    ++nimages_found;
-
-    try {
-        psf = fitpsf(pos);
-    } catch (RangeException& e) {
-        xdbg<<"fittedpsf range error: \n";
-        xdbg<<"p = "<<pos<<", b = "<<e.getBounds()<<std::endl;
-        input_flags |= FITTEDPSF_EXCEPTION;
-        return;
-    }
-
     // Make sure the use of trans in GetPixList won't throw:
     try {
         // We don't need to save skypos.  We just want to catch the range
@@ -272,11 +335,40 @@ static void getImagePixList(
     pix_list.back().usePool();
 #endif
 
+    // If the image is being read in tiles, get just the stamp that
+    // GetPixList needs.
+    const Image<double>* im = image;
+    const Image<double>* wt_im = weight_image;
+    std::auto_ptr<Image<double> > stamp;
+    std::auto_ptr<Image<double> > weight_stamp;
+    if (image_cache) {
+        Bounds stamp_bounds = GetPixListBounds(pos,trans,galap,params);
+        xdbg<<"stamp_bounds = "<<stamp_bounds<<std::endl;
+        stamp = image_cache->getStamp(stamp_bounds);
+        im = stamp.get();
+        if (weight_cache) {
+            weight_stamp = weight_cache->getStamp(stamp_bounds);
+            wt_im = weight_stamp.get();
+            // Make sure any bad pixels are marked with 0 variance.
+            if (badpix_cache) {
+                std::auto_ptr<Image<double> > badpix_stamp =
+                    badpix_cache->getStamp(stamp_bounds);
+                for(int i=0;i<=weight_stamp->getMaxI();++i) {
+                    for(int j=0;j<=weight_stamp->getMaxJ();++j) {
+                        if ((*badpix_stamp)(i,j) > 0.0) 
+                            (*weight_stamp)(i,j) = 0.0;
+                    }
+                }
+            }
+        }
+    }
+    Assert(im);
+
     flag = 0;
     xdbg<<"Before GetPixList mem = "<<memory_usage()<<std::endl;
     GetPixList(
-        im,pix_list.back(),pos,
-        sky,noise,weight_image,trans,galap,params,flag);
+        *im,pix_list.back(),pos,
+        sky,noise,wt_im,trans,galap,params,flag);
     xdbg<<"Got pixellist, flag = "<<FlagText(flag)<<std::endl;
     xdbg<<"After GetPixList mem = "<<memory_usage()<<std::endl;
     
@@ -302,76 +394,169 @@ static void getImagePixList(
     xdbg<<"Done getImagePixList: mem = "<<memory_usage()<<std::endl;
 }
 
-// Get pixel lists from the file specified in params
-bool MultiShearCatalog::getImagePixelLists(
-    int se_index, const Bounds& bounds)
+// Everything we need from a single-epoch image to extract the pixel lists
+// of the coadd objects that fall on it.
+struct SEImageData
+{
+    SEImageData(const ConfigFile& _params, int _se_index) :
+        params(_params), se_index(_se_index), use(false), inv_polish(true),
+        mean_sky(0.), noise(0.), mem(0.) {}
+
+    // The FittedPsf and ShearCatalog keep a reference to the params, 
+    // so each image keeps its own copy with its file names set.
+    // (Declared first, so it is destroyed last.)
+    ConfigFile params;
+    int se_index;
+
+    // Whether this image has anything in the current section.
+    // If not, nothing else is loaded.
+    bool use;
+
+    std::auto_ptr<ShearCatalog> shearcat;
+    std::auto_ptr<ShearCatalogTree> shearcat_tree;
+    std::auto_ptr<Transformation> trans;
+    Transformation inv_trans;
+    Bounds inv_bounds;
+    // Whether inv_trans needs to be followed by the exact inverse.
+    bool inv_polish;
+    std::auto_ptr<FittedPsf> fitpsf;
+
+    double mean_sky;
+    double noise;
+    std::auto_ptr<Image<double> > skymap;
+    std::auto_ptr<Image<double> > image;
+    std::auto_ptr<Image<double> > weight_image;
+    std::auto_ptr<ImageTileCache<double> > image_cache;
+    std::auto_ptr<ImageTileCache<double> > weight_cache;
+    std::auto_ptr<ImageTileCache<double> > badpix_cache;
+
+    // The memory taken by the images, in MB.
+    double mem;
+};
+
+// The objects that may fall on a single-epoch image, along with their
+// positions in the image and the psf interpolated there.
+struct SEObjects
+{
+    // These have an element for each object that might be on the image.
+    // index is the coadd index, in increasing order.
+    std::vector<int> index;
+    std::vector<Position> pos;
+    std::vector<long> flags;
+    // Whether pos is in the region where the psf is defined.
+    std::vector<char> found;
+    // Only set when found.
+    std::vector<BVec> psf;
+};
+
+// The number of objects whose psfs are interpolated together.
+static const int psf_chunk_size = 256;
+
+// The memory (in MB) used by the epochs from nbefore on.
+static double getAddedMem(
+    const std::vector<PixelList>& pix_list, const std::vector<BVec>& psf_list,
+    int nbefore)
+{
+    double mem = 0.;
+    const int nepoch = pix_list.size();
+    for(int k=nbefore;k<nepoch;++k) {
+        mem += sizeof(PixelList) + pix_list[k].size() * sizeof(Pixel);
+        mem += sizeof(BVec) + psf_list[k].size() * sizeof(double);
+    }
+    return mem / 1024. / 1024.;
+}
+
+static double getImageMem(const Image<double>* im)
+{
+    if (!im) return 0.;
+    return (im->getMaxI()+1.) * (im->getMaxJ()+1.) * 
+        sizeof(double) / (1024.*1024.);
+}
+
+// Read everything needed from the single-epoch image specified in 
+// data.params.  This doesn't modify anything in the MultiShearCatalog 
+// other than _saved_se_skybounds[se_index], so different images may be
+// loaded in different threads.
+void MultiShearCatalog::loadImageData(SEImageData& data, const Bounds& bounds)
 {
-    dbg<<"Start GetImagePixelLists: se_index = "<<se_index<<std::endl;
+    const int se_index = data.se_index;
+    const ConfigFile& params = data.params;
+    dbg<<"Start loadImageData: se_index = "<<se_index<<std::endl;
+    Assert(se_index < int(_saved_se_skybounds.size()));
 
     // If the skybounds for each shear catalog have been saved, then
     // we might be able to skip the ShearCatalog load.
-    if (int(_saved_se_skybounds.size()) > se_index) {
+    if (_saved_se_skybounds[se_index].isDefined()) {
         Bounds se_skybounds = _saved_se_skybounds[se_index];
         dbg<<"saved bounds for image "<<se_index<<" = "<<se_skybounds;
         if (!se_skybounds.intersects(bounds)) {
             dbg<<"Skipping index "<<se_index<<
                 " because bounds don't intersect\n";
-            return true;
+            return;
         }
     }
 
     // Read the shear catalog
-    ShearCatalog shearcat(_params);
-    shearcat.read();
+    data.shearcat.reset(new ShearCatalog(params));
+    const ShearCatalog& shearcat = *data.shearcat;
+    data.shearcat->read();
     Bounds se_skybounds = shearcat.getSkyBounds();
     Bounds se_bounds = shearcat.getBounds();
     dbg<<"bounds for image "<<se_index<<" = "<<se_skybounds;
 
     // Skip this file if none of the objects in it are in this section of sky.
-    if (int(_saved_se_skybounds.size()) <= se_index) {
-        // Then save the se_skybounds
-        Assert(int(_saved_se_skybounds.size()) == se_index);
-        _saved_se_skybounds.push_back(se_skybounds);
-    }
+    _saved_se_skybounds[se_index] = se_skybounds;
     if (!se_skybounds.intersects(bounds)) {
         dbg<<"Skipping index "<<se_index<<" because bounds don't intersect\n";
-        return true;
+        return;
     }
 
     // Read transformation between ra/dec and x/y
-    Transformation trans(_params);
+    data.trans.reset(new Transformation(params));
+    const Transformation& trans = *data.trans;
 
     // Read the psf
-    FittedPsf fitpsf(_params);
-    fitpsf.read();
+    data.fitpsf.reset(new FittedPsf(params));
+    data.fitpsf->read();
 
     // Make a tree of the shear catalog to more easily find the nearest
     // single-epoch object to each coadd detection.
-    ShearCatalogTree shearcat_tree(shearcat);
+    data.shearcat_tree.reset(new ShearCatalogTree(shearcat));
 
     // Figure out which method we are going to use to calculate the 
     // local sky values.
-    std::string sky_method = _params.get("multishear_sky_method");
+    std::string sky_method = params.get("multishear_sky_method");
     Assert(sky_method=="MEAN" || sky_method=="NEAREST" || sky_method=="MAP");
-    double mean_sky=0.;
-    std::auto_ptr<Image<double> > skymap(0);
     if (sky_method == "MEAN") {
         const int ngals = shearcat.size();
-        for(int i=0;i<ngals;++i) mean_sky += shearcat.getSky(i);
-        mean_sky /= shearcat.size();
+        for(int i=0;i<ngals;++i) data.mean_sky += shearcat.getSky(i);
+        data.mean_sky /= shearcat.size();
     }
     if (sky_method == "MAP") {
-        std::string skymap_name = MakeName(_params,"skymap",true,true);
-        int skymap_hdu = GetHdu(_params,"skymap",skymap_name,1);
-        skymap.reset(new Image<double>(skymap_name,skymap_hdu));
+        std::string skymap_name = MakeName(params,"skymap",true,true);
+        int skymap_hdu = GetHdu(params,"skymap",skymap_name,1);
+        data.skymap.reset(new Image<double>(skymap_name,skymap_hdu));
     }
 
-    BVec psf(fitpsf.getPsfOrder(), fitpsf.getSigma());
-
     // Make an inverse transformation that we will use as a starting 
     // point for the more accurate InverseTransform function.
-    Transformation inv_trans;
-    Bounds inv_bounds = inv_trans.makeInverseOf(trans,se_bounds,4);
+    // If multishear_inverse_max_error is set, and the fitted inverse is
+    // at least that accurate everywhere on the image, then we skip the
+    // exact InverseTransform.
+    Transformation& inv_trans = data.inv_trans;
+    Bounds& inv_bounds = data.inv_bounds;
+    int inv_order = params.read("multishear_inverse_order",4);
+    double inv_max_error = params.read("multishear_inverse_max_error",0.);
+    data.inv_polish = true;
+    if (inv_max_error > 0.) {
+        double inv_error;
+        inv_bounds = inv_trans.makeInverseOf(
+            trans,se_bounds,inv_order,&inv_error);
+        dbg<<"inverse error = "<<inv_error<<std::endl;
+        data.inv_polish = !(inv_error <= inv_max_error);
+    } else {
+        inv_bounds = inv_trans.makeInverseOf(trans,se_bounds,inv_order);
+    }
     dbg<<"skybounds = "<<_skybounds<<std::endl;
     dbg<<"se_skybounds = "<<se_skybounds<<std::endl;
     dbg<<"se_bounds = "<<se_bounds<<std::endl;
@@ -379,19 +564,22 @@ bool MultiShearCatalog::getImagePixelLists(
 
     // We always use the maximum aperture size here, since we don't know
     // how big the galaxy is yet, so we don't know what galap will be.
-    double gal_aperture = _params.get("shear_aperture");
-    double max_aperture = _params.get("shear_max_aperture");
+    double max_aperture = params.get("shear_max_aperture");
 
     // Load the image
     // The bounds needed are 
-    std::auto_ptr<Image<double> > image;
-    std::auto_ptr<Image<double> > weight_image;
+    // If multishear_image_tile_size is set, then rather than loading the
+    // image (or the part of it covering this section), we read tiles of
+    // the image as they are needed for each galaxy's stamp.
+    int tile_size = params.read("multishear_image_tile_size",0);
+    bool use_tiles = tile_size > 0;
     if (_skybounds.includes(se_skybounds)) {
-        image.reset(new Image<double>(_params,weight_image));
+        if (!use_tiles) 
+            data.image.reset(new Image<double>(params,data.weight_image));
     } else if (!_skybounds.intersects(inv_bounds)) {
         dbg<<"Skipping index "<<se_index<<" because inv_bounds doesn't intersect\n";
-        return true;
-    } else {
+        return;
+    } else if (!use_tiles) {
         Bounds intersect = inv_bounds & _skybounds;
         dbg<<"intersect = invb & skybounds = "<<intersect<<std::endl;
 
@@ -409,15 +597,71 @@ bool MultiShearCatalog::getImagePixelLists(
         sub_bounds.addBorder(max_aperture / pixel_scale);
 
         dbg<<"subb = "<<sub_bounds<<std::endl;
-        image.reset(new Image<double>(_params,weight_image,sub_bounds));
+        data.image.reset(
+            new Image<double>(params,data.weight_image,sub_bounds));
+    }
+    if (use_tiles) {
+        // The memory budget is shared among the image, weight and
+        // badpix caches.
+        bool use_weight = params.keyExists("noise_method") &&
+            params["noise_method"] == "WEIGHT_IMAGE";
+        bool use_badpix = use_weight && (
+            params.keyExists("badpix_file") || 
+            params.keyExists("badpix_ext"));
+        int ncache = 1 + (use_weight ? 1 : 0) + (use_badpix ? 1 : 0);
+        double cache_mem = 
+            params.read("multishear_image_cache_mem",200.)*1024.*1024.;
+        cache_mem /= ncache;
+        dbg<<"Using image tiles of size "<<tile_size<<
+            ", cache_mem = "<<cache_mem<<" for each of "<<ncache<<
+            " images\n";
+
+        std::string image_name = MakeName(params,"image",true,true);
+        int image_hdu = GetHdu(params,"image",image_name,1);
+        data.image_cache.reset(new ImageTileCache<double>(
+                image_name,image_hdu,tile_size,cache_mem));
+        if (use_weight) {
+            std::string weight_name = MakeName(params,"weight",true,true);
+            int weight_hdu = GetHdu(params,"weight",weight_name,1);
+            data.weight_cache.reset(new ImageTileCache<double>(
+                    weight_name,weight_hdu,tile_size,cache_mem));
+        }
+        if (use_badpix) {
+            std::string badpix_name = MakeName(params,"badpix",true,true);
+            int badpix_hdu = GetHdu(params,"badpix",badpix_name,1);
+            data.badpix_cache.reset(new ImageTileCache<double>(
+                    badpix_name,badpix_hdu,tile_size,cache_mem));
+        }
+        data.mem = ncache * cache_mem / (1024.*1024.);
     }
 
     // We are using the weight image so the noise and gain are dummy variables
-    Assert(weight_image.get());
-    double noise = 0.0;
-    //double gain = 0.0;
+    Assert(data.weight_image.get() || data.weight_cache.get());
+    data.noise = 0.0;
+
+    data.mem += getImageMem(data.image.get()) + 
+        getImageMem(data.weight_image.get()) + 
+        getImageMem(data.skymap.get());
+    dbg<<"Done loadImageData: se_index = "<<se_index<<
+        ", mem = "<<data.mem<<" MB\n";
+    data.use = true;
+}
+
+// Extract the pixel lists for each object in bounds from the images
+// in images, while at the same time loading the images in next_images.
+// The images are loaded by whichever threads get to them first, and 
+// those threads then join the others in extracting the pixel lists.
+// Each object is done by a single thread, which goes through the images
+// in order, so the epochs for each object are always in the same order.
+// Returns false if the memory exceeds max_vmem.
+bool MultiShearCatalog::getImagePixelLists(
+    const std::vector<boost::shared_ptr<SEImageData> >& images,
+    const std::vector<boost::shared_ptr<SEImageData> >& next_images,
+    const Bounds& bounds)
+{
+    dbg<<"Start GetImagePixelLists: nimages = "<<images.size()<<
+        ", nnext = "<<next_images.size()<<std::endl;
 
-    dbg<<"Extracting pixel lists\n";
     // loop over the the objects, if the object falls on the image get
     // the pixel list
     Assert(int(_skypos.size()) == size());
@@ -428,31 +672,219 @@ bool MultiShearCatalog::getImagePixelLists(
     Assert(int(_nimages_found.size()) == size());
     Assert(int(_nimages_gotpix.size()) == size());
 
-    const int ngals = size();
+    // Only bother with the images that overlap this section.
+    std::vector<const SEImageData*> use_images;
+    const int nimages = images.size();
+    for(int k=0;k<nimages;++k) {
+        if (images[k]->use) use_images.push_back(images[k].get());
+    }
+    const int nuse = use_images.size();
+    const int nnext = next_images.size();
+
+    double gal_aperture = _params.get("shear_aperture");
+    double max_aperture = _params.get("shear_max_aperture");
     double max_mem = _params.read("max_vmem",64)*1024.;
-    dbg<<"Before getImagePixList loop: memory_usage = "<<memory_usage()<<std::endl;
-    for (int i=0; i<ngals; ++i) {
-        if (_flags[i]) continue;
-        if (!bounds.includes(_skypos[i])) continue;
-        if (!inv_bounds.includes(_skypos[i])) continue;
-        dbg<<"getImagePixList for galaxy "<<i<<", id = "<<_id[i]<<std::endl;
-        getImagePixList(
-            _pix_list[i], _psf_list[i],
-            _se_num[i], _se_pos[i], se_index,
-            _input_flags[i], _nimages_found[i], _nimages_gotpix[i], _skypos[i], 
-            *image, trans, inv_trans, psf, fitpsf, shearcat, shearcat_tree,
-            weight_image.get(), noise, mean_sky, skymap.get(),
-            gal_aperture, max_aperture, _params);
-        double mem = memory_usage();
-        if (mem > max_mem) {
-            dbg<<"VmSize = "<<mem<<" > max_vmem = "<<max_mem<<std::endl;
-            return false;
+    bool des_qa = _params.read("des_qa",false); 
+    bool out_of_mem = false;
+    bool load_error = false;
+    std::string load_error_msg;
+
+    // The objects in this section.
+    const PositionGrid& grid = getSkyPosGrid();
+    std::vector<int> section_gals;
+    grid.findInBounds(bounds,section_gals);
+    section_gals.erase(
+        std::remove_if(section_gals.begin(),section_gals.end(),
+                       HasFlag(_flags)),
+        section_gals.end());
+    const int nsection_gals = section_gals.size();
+    dbg<<nsection_gals<<" unflagged galaxies in section\n";
+
+    // Find which objects might be on each image.
+    std::vector<SEObjects> objects(nuse);
+    std::vector<std::pair<int,int> > chunks;
+    for(int k=0;k<nuse;++k) {
+        const SEImageData& data = *use_images[k];
+        SEObjects& obj = objects[k];
+        Bounds b = bounds & data.inv_bounds;
+        if (b.isDefined()) {
+            std::vector<int> candidates;
+            grid.findInBounds(b,candidates);
+            const int ncand = candidates.size();
+            for (int j=0; j<ncand; ++j) {
+                const int i = candidates[j];
+                if (_flags[i]) continue;
+                // b is the intersection, but check both in case of 
+                // rounding at the edges.
+                if (!bounds.includes(_skypos[i])) continue;
+                if (!data.inv_bounds.includes(_skypos[i])) continue;
+                obj.index.push_back(i);
+            }
         }
+        const int nobj = obj.index.size();
+        obj.pos.resize(nobj);
+        obj.flags.resize(nobj,0);
+        obj.found.resize(nobj,0);
+        obj.psf.resize(
+            nobj,BVec(data.fitpsf->getPsfOrder(),data.fitpsf->getSigma()));
+        for(int n=0;n<nobj;n+=psf_chunk_size) 
+            chunks.push_back(std::make_pair(k,n));
     }
+    const int nchunks = chunks.size();
+
+    // Checking memory_usage() for every object is quite slow, since it 
+    // reads /proc/self/status.  So instead keep a count of the memory 
+    // added to the pixel lists, and only check the real value each time
+    // that count goes up by another recheck_mem.  (The count alone would
+    // miss things like fragmentation in the pools.)
+    double base_mem = memory_usage();
+    double added_mem = 0.;
+    const double recheck_mem = std::max(max_mem / 100., 1.);
+    dbg<<"Before getImagePixList loop: memory_usage = "<<base_mem<<std::endl;
+#ifdef _OPENMP
+#pragma omp parallel 
+    {
+        try {
+#endif
+            // Find the position of each object on each image, and 
+            // interpolate the psfs there, a chunk at a time.
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+            for(int c=0;c<nchunks;++c) {
+                const int k = chunks[c].first;
+                const SEImageData& data = *use_images[k];
+                SEObjects& obj = objects[k];
+                const int n1 = chunks[c].second;
+                const int n2 = std::min(n1+psf_chunk_size,int(obj.index.size()));
+                std::vector<Position> skypos(n2-n1);
+                for(int n=n1;n<n2;++n) skypos[n-n1] = _skypos[obj.index[n]];
+                std::vector<Position> pos;
+                std::vector<long> flags;
+                std::vector<char> found;
+                getImagePos(
+                    skypos, *data.trans, data.inv_trans, data.inv_polish,
+                    *data.fitpsf, pos, flags, found);
+                std::vector<Position> psf_pos;
+                for(int n=n1;n<n2;++n) {
+                    obj.pos[n] = pos[n-n1];
+                    obj.flags[n] = flags[n-n1];
+                    obj.found[n] = found[n-n1];
+                    if (obj.found[n]) psf_pos.push_back(obj.pos[n]);
+                }
+                std::vector<BVec> psf;
+                data.fitpsf->interpolateMany(psf_pos,psf);
+                for(int n=n1,m=0;n<n2;++n) if (obj.found[n]) {
+                    obj.psf[n] = psf[m++];
+                }
+            }
+
+            // Load the next images.  The loop is nowait, so the threads 
+            // that finish early go straight on to the loop below.
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic) nowait
+#endif
+            for(int k=0;k<nnext;++k) {
+                try {
+                    loadImageData(*next_images[k],bounds);
+                } catch (std::exception& e) {
+                    // Can't throw out of a parallel region, so save the 
+                    // message and throw it below.
+#ifdef _OPENMP
+#pragma omp critical (load_error)
+#endif
+                    {
+                        if (!load_error) {
+                            load_error = true;
+                            load_error_msg = e.what();
+                        }
+                    }
+                }
+            }
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+            for (int j=0; j<nsection_gals; ++j) {
+                if (nuse == 0) continue;
+#ifdef _OPENMP
+#pragma omp flush (out_of_mem)
+#endif
+                if (out_of_mem) continue;
+                const int i = section_gals[j];
+                const int nbefore = _pix_list[i].size();
+                bool any = false;
+                for(int k=0;k<nuse;++k) {
+                    const SEImageData& data = *use_images[k];
+                    const SEObjects& obj = objects[k];
+                    std::vector<int>::const_iterator it = std::lower_bound(
+                        obj.index.begin(),obj.index.end(),i);
+                    if (it == obj.index.end() || *it != i) continue;
+                    const int n = it - obj.index.begin();
+                    any = true;
+                    _input_flags[i] |= obj.flags[n];
+                    if (!obj.found[n]) continue;
+                    ++_nimages_found[i];
+                    dbg<<"getImagePixList for galaxy "<<i<<", id = "<<
+                        _id[i]<<", image "<<data.se_index<<std::endl;
+                    getImagePixList(
+                        _pix_list[i], _psf_list[i],
+                        _se_num[i], _se_pos[i], data.se_index,
+                        _input_flags[i], _nimages_gotpix[i], 
+                        obj.pos[n], obj.psf[n],
+                        data.image.get(), *data.trans, 
+                        *data.shearcat, *data.shearcat_tree,
+                        data.weight_image.get(), data.noise, data.mean_sky, 
+                        data.skymap.get(),
+                        data.image_cache.get(), data.weight_cache.get(), 
+                        data.badpix_cache.get(),
+                        gal_aperture, max_aperture, data.params);
+                }
+                if (!any) continue;
+                double mem1 = getAddedMem(_pix_list[i],_psf_list[i],nbefore);
+#ifdef _OPENMP
+#pragma omp critical (count_mem)
+#endif
+                {
+                    added_mem += mem1;
+                    if (added_mem > recheck_mem) {
+                        base_mem = memory_usage();
+                        added_mem = 0.;
+                    }
+                    double mem = base_mem + added_mem;
+                    if (mem > max_mem) {
+                        dbg<<"VmSize = "<<mem<<" > max_vmem = "<<max_mem<<std::endl;
+                        out_of_mem = true;
+                    }
+                }
+#ifdef _OPENMP
+#pragma omp flush (out_of_mem)
+#endif
+            }
+#ifdef _OPENMP
+        } catch (std::exception& e) {
+            // This isn't supposed to happen.
+            if (des_qa) {
+                std::cerr<<"STATUS5BEG Caught error in parallel region STATUS5END\n";
+            } 
+            std::cerr<<"Caught "<<e.what()<<std::endl;
+            std::cerr<<"Caught error in parallel region.  Aborting.\n";
+            exit(1);
+        } catch (...) {
+            if (des_qa) {
+                std::cerr<<"STATUS5BEG Caught error in parallel region STATUS5END\n";
+            }
+            std::cerr<<"Caught error in parallel region.  Aborting.\n";
+            exit(1);
+        }
+    }
+#endif
+    if (load_error) throw ReadException(load_error_msg);
+    if (out_of_mem) return false;
+
     // Keep track of how much memory we are using.
     dbg<<"Done getImagePixList loop: memory_usage = "<<memory_usage()<<std::endl;
     if (dbgout) PixelList::dumpPool(*dbgout);
-    dbg<<"Using image# "<<se_index;
     dbg<<"... Memory Usage in MultiShearCatalog = ";
     dbg<<calculateMemoryFootprint()<<" MB";
     dbg<<"\n";
@@ -466,6 +898,84 @@ bool MultiShearCatalog::getImagePixelLists(
     return true;
 }
 
+// Get pixel lists from the file specified in params
+bool MultiShearCatalog::getImagePixelLists(
+    int se_index, const Bounds& bounds)
+{
+    if (int(_saved_se_skybounds.size()) <= se_index)
+        _saved_se_skybounds.resize(se_index+1);
+    std::vector<boost::shared_ptr<SEImageData> > images(
+        1, boost::shared_ptr<SEImageData>(new SEImageData(_params,se_index)));
+    loadImageData(*images[0],bounds);
+    return getImagePixelLists(
+        images, std::vector<boost::shared_ptr<SEImageData> >(), bounds);
+}
+
+// Get pixel lists from all the single-epoch images.
+//
+// Reading the images (and their catalogs, psf and wcs) is a large part 
+// of the time, so if multishear_prefetch_nimages = N > 0, the next N 
+// images are read in the background while the pixel lists are being
+// extracted from the current ones.  
+// The number read ahead is also limited so that the prefetched images 
+// don't use more than half of the memory remaining below max_vmem.  
+bool MultiShearCatalog::getAllImagePixelLists(const Bounds& bounds)
+{
+    int nfiles = _image_file_list.size();
+#ifdef ONLY_N_IMAGES
+    if (nfiles > ONLY_N_IMAGES) nfiles = ONLY_N_IMAGES;
+#endif
+    if (int(_saved_se_skybounds.size()) < nfiles)
+        _saved_se_skybounds.resize(nfiles);
+
+    int nprefetch = _params.read("multishear_prefetch_nimages",0);
+    Assert(nprefetch >= 0);
+    double max_mem = _params.read("max_vmem",64)*1024.;
+    dbg<<"nprefetch = "<<nprefetch<<std::endl;
+
+    typedef std::vector<boost::shared_ptr<SEImageData> > ImageList;
+    ImageList images, next_images;
+    int next = 0;
+    // The most memory used by any one image so far.
+    double image_mem = 0.;
+    while (next < nfiles || images.size() > 0) {
+        // Set up the next batch of images to read.
+        int nnext = nfiles - next;
+        if (nprefetch == 0) {
+            // No prefetching.  Read the next image, and then extract 
+            // its pixels.
+            if (images.size() > 0) nnext = 0;
+            else if (nnext > 1) nnext = 1;
+        } else {
+            if (nnext > nprefetch) nnext = nprefetch;
+            if (image_mem > 0.) {
+                double avail = (max_mem - memory_usage()) / 2.;
+                int nfit = int(avail / image_mem);
+                if (nfit < 1) nfit = 1;
+                if (nnext > nfit) nnext = nfit;
+            }
+        }
+        dbg<<"Reading images "<<next<<" .. "<<next+nnext-1<<std::endl;
+        for(int k=0;k<nnext;++k,++next) {
+            boost::shared_ptr<SEImageData> data(
+                new SEImageData(_params,next));
+            setImageParams(data->params,next);
+            next_images.push_back(data);
+        }
+
+        if (!getImagePixelLists(images,next_images,bounds)) return false;
+
+        const int nloaded = next_images.size();
+        for(int k=0;k<nloaded;++k) {
+            if (next_images[k]->mem > image_mem) 
+                image_mem = next_images[k]->mem;
+        }
+        images.swap(next_images);
+        next_images.clear();
+    }
+    return true;
+}
+
 template <typename T>
 inline long long getMemoryFootprint(const T& x)
 {
@@ -2,6 +2,55 @@
 #include "Pixel.h"
 #include "Params.h"
 
+void PixelColumns::useArena()
+{
+    Assert(size() == 0);
+    ArenaAllocator<value_type> alloc(Arena::getThreadArena());
+    Column(alloc).swap(_u);
+    Column(alloc).swap(_v);
+    Column(alloc).swap(_flux);
+    Column(alloc).swap(_inverse_sigma);
+}
+
+void PixelColumns::assign(const PixelList& pix)
+{
+    const int npix = pix.size();
+    resize(npix);
+    for(int i=0;i<npix;++i) setPixel(i,pix[i]);
+}
+
+void PixelColumns::resize(const int n)
+{
+    _u.resize(n);
+    _v.resize(n);
+    _flux.resize(n);
+    _inverse_sigma.resize(n);
+}
+
+void PixelColumns::clear()
+{
+    _u.clear();
+    _v.clear();
+    _flux.clear();
+    _inverse_sigma.clear();
+}
+
+void PixelColumns::push_back(const Pixel& p)
+{
+    _u.push_back(std::real(p.getPos()));
+    _v.push_back(std::imag(p.getPos()));
+    _flux.push_back(p.getFlux());
+    _inverse_sigma.push_back(p.getInverseSigma());
+}
+
+void PixelColumns::setPixel(const int i, const Pixel& p)
+{
+    _u[i] = std::real(p.getPos());
+    _v[i] = std::imag(p.getPos());
+    _flux[i] = p.getFlux();
+    _inverse_sigma[i] = p.getInverseSigma();
+}
+
 void GetPixList(
     const Image<double>& im, PixelList& pix,
     const Position cen, double sky, double noise,
@@ -157,6 +206,27 @@ void GetPixList(
     if (npix < 10) flag |= LT10PIX;
 }
 
+Bounds GetPixListBounds(
+    const Position cen, const Transformation& trans,
+    double aperture, const ConfigFile& params)
+{
+    double x_offset = params.read("cat_x_offset",0.);
+    double y_offset = params.read("cat_y_offset",0.);
+
+    // Use the same xap, yap as in GetPixList above.
+    DSmallMatrix22 D;
+    trans.getDistortion(cen,D);
+    double det = std::abs(D.TMV_det());
+    double xap = aperture * sqrt(D(1,0)*D(1,0) + D(1,1)*D(1,1))/det;
+    double yap = aperture * sqrt(D(0,0)*D(0,0) + D(0,1)*D(0,1))/det;
+
+    double xcen = cen.getX() - x_offset;
+    double ycen = cen.getY() - y_offset;
+    return Bounds(
+        floor(xcen-xap)-1., ceil(xcen+xap)+2.,
+        floor(ycen-yap)-1., ceil(ycen+yap)+2.);
+}
+
 double GetLocalSky(
     const Image<double>& bkg, 
     const Position cen, const Transformation& trans, double aperture,
@@ -4,6 +4,7 @@
 #define PIXELLIST_USE_POOL
 
 #include <complex>
+#include <vector>
 #include <string>
 
 #ifdef __INTEL_COMPILER
@@ -18,9 +19,12 @@
 #include "Image.h"
 #include "ConfigFile.h"
 #include "Bounds.h"
+#include "Arena.h"
 
 #ifdef PIXELLIST_USE_POOL
-#define PIXELLIST_BLOCK 1024*1024*100  // 100 MB per block
+// 100 MB per block of the shared pool.  Each thread uses blocks 1/64 this
+// size for its own shard (see ShardedPool).
+#define PIXELLIST_BLOCK 1024*1024*100
 #include "PoolAllocator.h"
 #endif
 
@@ -58,10 +62,12 @@ private :
     double _inverse_sigma;
 };
 
-// Most of these methods are not (intrinsically) thread-safe, 
-// since they might be using my pool allocator, so they need to 
-// be wrapped in a critical block.
-// Therefore, all the methods for PixelList are defined in Pixel_omp.cpp.
+// The pool allocator keeps a separate pool for each thread (see 
+// ShardedPool in Pool.h), so these methods don't need to be wrapped in
+// critical blocks.  A list may even be freed by a different thread 
+// than the one that filled it.  
+// (The methods for PixelList are still defined in Pixel_omp.cpp, since
+// the pool needs to be compiled with OpenMP.)
 
 class PixelList
 {
@@ -90,13 +96,21 @@ public :
 
     // Start not using Pool allocator.  Turn it on with this:
     void usePool();
+    // Or use the current thread's Arena (see Arena.h).  This is only 
+    // appropriate for lists that are local to an ArenaScope.
+    // Like usePool, this should be done before any elements are added.
+    void useArena();
     static void dumpPool(std::ostream& os);
+    // Per-thread numbers of allocations and frees, and memory used.
+    static void dumpPoolStats(std::ostream& os);
     static void reclaimMemory();
 
 private :
 
+    typedef std::vector<Pixel,ArenaAllocator<Pixel> > PixelVector;
+
     bool _use_pool;
-    boost::shared_ptr<std::vector<Pixel> > _v1;
+    boost::shared_ptr<PixelVector> _v1;
 #ifdef PIXELLIST_USE_POOL
     typedef PoolAllocator<Pixel,PIXELLIST_BLOCK> PoolAllocPixel;
     boost::shared_ptr<std::vector<Pixel,PoolAllocPixel> > _v2;
@@ -106,12 +120,85 @@ private :
 
 };
 
+// A column-oriented (structure of arrays) copy of a PixelList.
+// The u, v, flux and inverse sigma values are each stored in their own
+// contiguous array, so the loops that set up the design matrix for a 
+// shapelet fit can stream through them with unit stride, rather than 
+// striding through the interleaved Pixel structs.
+//
+// It is intended to be built once from a PixelList and then used for 
+// several measurements of the same pixels.  
+//
+// Define PIXELCOLUMNS_USE_FLOAT to store the values as floats instead.
+// This halves the memory traffic, but of course the inputs only have
+// single precision then.  The calculations are still done in double.
+
+//#define PIXELCOLUMNS_USE_FLOAT
+
+class PixelColumns
+{
+public :
+
+#ifdef PIXELCOLUMNS_USE_FLOAT
+    typedef float value_type;
+#else
+    typedef double value_type;
+#endif
+
+    PixelColumns() {}
+    explicit PixelColumns(const PixelList& pix) { assign(pix); }
+    ~PixelColumns() {}
+
+    // Take the memory from the current thread's Arena (see Arena.h).
+    // Only appropriate if this is local to an ArenaScope.
+    // This should be done before any elements are added.
+    void useArena();
+
+    void assign(const PixelList& pix);
+
+    int size() const { return _u.size(); }
+    void resize(const int n);
+    void clear();
+    void push_back(const Pixel& p);
+
+    std::complex<double> getPos(const int i) const 
+    { return std::complex<double>(_u[i],_v[i]); }
+    double getFlux(const int i) const { return _flux[i]; }
+    double getInverseSigma(const int i) const { return _inverse_sigma[i]; }
+    Pixel getPixel(const int i) const
+    { return Pixel(_u[i],_v[i],_flux[i],_inverse_sigma[i]); }
+    void setPixel(const int i, const Pixel& p);
+
+    // Direct access to the columns.  Only valid if size() > 0.
+    const value_type* getUArray() const { return &_u[0]; }
+    const value_type* getVArray() const { return &_v[0]; }
+    const value_type* getFluxArray() const { return &_flux[0]; }
+    const value_type* getInverseSigmaArray() const 
+    { return &_inverse_sigma[0]; }
+
+private :
+
+    typedef std::vector<value_type,ArenaAllocator<value_type> > Column;
+
+    Column _u;
+    Column _v;
+    Column _flux;
+    Column _inverse_sigma;
+};
+
 void GetPixList(
     const Image<double>& im, PixelList& pix,
     const Position cen, double sky, double noise,
     const Image<double>* weight_image, const Transformation& trans,
     double aperture, const ConfigFile& params, long& flag);
 
+// The region of the image that GetPixList will read for these parameters,
+// including a one pixel border.  This is useful for reading only a 
+// small stamp of a large image.
+Bounds GetPixListBounds(
+    const Position cen, const Transformation& trans,
+    double aperture, const ConfigFile& params);
+
 double GetLocalSky(
     const Image<double>& bkg, 
     const Position cen, const Transformation& trans, double aperture,
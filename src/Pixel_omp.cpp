@@ -2,11 +2,11 @@
 #include "Pixel.h"
 
 PixelList::PixelList() :
-    _use_pool(false), _v1(new std::vector<Pixel>()) 
+    _use_pool(false), _v1(new PixelVector()) 
 {}
 
 PixelList::PixelList(const int n) :
-    _use_pool(false), _v1(new std::vector<Pixel>(n)) 
+    _use_pool(false), _v1(new PixelVector(n)) 
 {}
 
 PixelList::PixelList(const PixelList& rhs) :
@@ -17,24 +17,12 @@ PixelList& PixelList::operator=(const PixelList& rhs)
 {
     _use_pool = rhs._use_pool;
     _v1 = rhs._v1;
-#ifdef _OPENMP
-#pragma omp critical (PixelList)
-#endif
-    {
-        _v2 = rhs._v2;
-    }
+    _v2 = rhs._v2;
     return *this;
 }
 
 PixelList::~PixelList()
-{
-#ifdef _OPENMP
-#pragma omp critical (PixelList)
-#endif
-    {
-        _v2.reset();
-    }
-}
+{}
 
 void PixelList::usePool() 
 {
@@ -43,16 +31,20 @@ void PixelList::usePool()
     if (_v1.get()) Assert(_v1->size() == 0);
     if (_v2.get()) Assert(_v2->size() == 0);
     _v1.reset();
-#ifdef _OPENMP
-#pragma omp critical (PixelList)
-#endif
-    {
-        _v2.reset(new std::vector<Pixel,PoolAllocPixel>());
-    }
+    _v2.reset(new std::vector<Pixel,PoolAllocPixel>());
     _use_pool = true; 
 #endif
 }
 
+void PixelList::useArena()
+{
+    if (_v1.get()) Assert(_v1->size() == 0);
+    if (_v2.get()) Assert(_v2->size() == 0);
+    _v1.reset(new PixelVector(ArenaAllocator<Pixel>(Arena::getThreadArena())));
+    _v2.reset();
+    _use_pool = false;
+}
+
 void PixelList::dumpPool(std::ostream& os) 
 {
 #ifdef PIXELLIST_USE_POOL
@@ -64,6 +56,15 @@ void PixelList::dumpPool(std::ostream& os)
 #endif
 }
 
+void PixelList::dumpPoolStats(std::ostream& os) 
+{
+#ifdef PIXELLIST_USE_POOL
+    PoolAllocPixel::stats(os);
+#else
+    os<<"Not using PoolAlloc\n";
+#endif
+}
+
 void PixelList::reclaimMemory()
 {
 #ifdef PIXELLIST_USE_POOL
@@ -80,12 +81,7 @@ int PixelList::size() const
 void PixelList::reserve(const int n)
 {
     if (_use_pool) {
-#ifdef _OPENMP
-#pragma omp critical (PixelList)
-#endif
-        {
-            _v2->reserve(n);
-        }
+        _v2->reserve(n);
     } else {
         _v1->reserve(n);
     }
@@ -97,12 +93,7 @@ int PixelList::capacity() const
 void PixelList::resize(const int n)
 {
     if (_use_pool) {
-#ifdef _OPENMP
-#pragma omp critical (PixelList)
-#endif
-        {
-            _v2->resize(n);
-        }
+        _v2->resize(n);
     } else {
         _v1->resize(n);
     }
@@ -111,12 +102,7 @@ void PixelList::resize(const int n)
 void PixelList::clear()
 {
     if (_use_pool) {
-#ifdef _OPENMP
-#pragma omp critical (PixelList)
-#endif
-        {
-            _v2->clear();
-        }
+        _v2->clear();
     } else {
         _v1->clear();
     }
@@ -125,12 +111,7 @@ void PixelList::clear()
 void PixelList::push_back(const Pixel& p)
 {
     if (_use_pool) {
-#ifdef _OPENMP
-#pragma omp critical (PixelList)
-#endif
-        {
-            _v2->push_back(p);
-        }
+        _v2->push_back(p);
     } else {
         _v1->push_back(p);
     }
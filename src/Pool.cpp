@@ -17,13 +17,15 @@
 #include "Pool.h"
 
 template <int blockSize>
-Pool<blockSize>::Pool()
+Pool<blockSize>::Pool(bool preallocate)
 {
 #ifdef VG
     VALGRIND_CREATE_MEMPOOL(&_allBlocks,0,false);
 #endif
-    PoolBlock* b = growPool();
-    _freeBlocks.insert(b);
+    if (preallocate) {
+        PoolBlock* b = growPool();
+        _freeBlocks.insert(b);
+    }
 }
 
 template <int blockSize>
@@ -36,8 +38,8 @@ Pool<blockSize>::~Pool()
 }
 
 template <int blockSize>
-int Pool<blockSize>::totalMemoryUsed() const 
-{ return _allBlocks.size() * blockSize; }
+long long Pool<blockSize>::totalMemoryUsed() const 
+{ return (long long)(_allBlocks.size()) * blockSize; }
 
 template <int blockSize>
 void* Pool<blockSize>::allocate(size_t size)
@@ -338,11 +340,13 @@ void Pool<blockSize>::reclaim()
             dbg<<"_freeBlocks.size() => "<<_freeBlocks.size()<<std::endl;
             Assert(nerased == 1);
             dbg<<"Before Kill temp\n";
-            dump(*dbgout);
+            if (dbgout) dump(*dbgout);
             kill(temp);
             dbg<<"After Kill temp\n";
-            dump(*dbgout);
-            check(*dbgout);
+            if (dbgout) {
+                dump(*dbgout);
+                check(*dbgout);
+            }
         } else {
           ++block;
         }
@@ -355,6 +359,7 @@ void Pool<blockSize>::reclaim()
 }
 
 template class Pool<PIXELLIST_BLOCK>;
+template class Pool<ShardedPool<PIXELLIST_BLOCK>::SHARD_BLOCK>;
 
 #ifdef _WIN32
 #pragma warning(pop)
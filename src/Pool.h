@@ -14,6 +14,9 @@ struct PoolBlock
     PoolBlock* next;
     int size;
     bool free;
+    // The ShardedPool shard that allocated this block, or -1 for its
+    // shared pool.  (Only meaningful for blocks that are in use.)
+    short owner;
 };
 
 struct PoolBlockPtr
@@ -44,10 +47,12 @@ class Pool
 {
 public :
 
-    Pool();
+    // If preallocate is false, the first block isn't allocated until
+    // it is needed.
+    Pool(bool preallocate=true);
     ~Pool();
 
-    int totalMemoryUsed() const;
+    long long totalMemoryUsed() const;
     void* allocate(size_t size);
     void deallocate(void *p, size_t = 0);
 
@@ -85,10 +90,68 @@ private :
     PoolBlock* growPool();
 };
 
+// A Pool is not thread-safe, so ShardedPool keeps a separate Pool for
+// each thread.  A thread allocates from its own shard without any locking.
+// Memory may be freed by a different thread than the one that allocated 
+// it.  In that case it is put on a list for the owning shard, and the 
+// owner frees it the next time it allocates or frees something.  Only 
+// that list is protected by a lock, and it is normally uncontended.
+//
+// The shards use much smaller blocks than blockSize, so each thread only
+// adds a little to the virtual memory of the process.  Allocations that
+// are too big for a shard (and all allocations by a thread beyond the
+// first MAX_SHARDS running at once) come from a single shared Pool with 
+// the full blockSize, which is protected by a lock.
+//
+// The implementation is in Pool_omp.cpp.
+template <int blockSize> struct PoolShard;
+
+template <int blockSize>
+class ShardedPool
+{
+public :
+
+    ShardedPool();
+    ~ShardedPool();
+
+    long long totalMemoryUsed() const;
+    void* allocate(size_t size);
+    void deallocate(void *p, size_t = 0);
+
+    // These all act on every shard, so they should only be called when 
+    // no other threads are using the pool.
+    void dump(std::ostream& os);
+    void summary(std::ostream& os);
+    void reclaim();
+
+    // Write the number of allocations, frees, and frees from other 
+    // threads, along with the memory used for each thread's shard.
+    void stats(std::ostream& os) const;
+
+    enum { MAX_SHARDS = 1024 };
+    enum { SHARD_BLOCK = blockSize / 64 };
+    // The largest allocation (including the PoolBlock header) that is 
+    // done from a shard.  Anything bigger would leave most of a shard 
+    // block unusable, so it comes from the shared pool.
+    enum { MAX_SHARD_ALLOC = SHARD_BLOCK / 4 };
+
+private :
+
+    PoolShard<SHARD_BLOCK>* getShard(int i);
+
+    PoolShard<SHARD_BLOCK>* _shards[MAX_SHARDS];
+    PoolShard<blockSize>* _shared;
+
+    ShardedPool(const ShardedPool&);
+    ShardedPool& operator=(const ShardedPool&);
+};
+
 // Need to instantiate all blockSizes that you want to use:
 
 #include "Pixel.h"
 extern template class Pool<PIXELLIST_BLOCK>;
+extern template class Pool<ShardedPool<PIXELLIST_BLOCK>::SHARD_BLOCK>;
+extern template class ShardedPool<PIXELLIST_BLOCK>;
 
 #endif
 
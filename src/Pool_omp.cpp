@@ -0,0 +1,305 @@
+
+#include <vector>
+#include "dbg.h"
+#include "Pool.h"
+
+#ifdef _OPENMP
+#include "omp.h"
+#include <pthread.h>
+#endif
+
+// Each thread gets an index the first time it uses a ShardedPool, which
+// picks its shard in every pool.  (omp_get_thread_num isn't good enough,
+// since it is only unique within a team of threads.)
+// When a thread exits, its index is put back on a free list for the next
+// new thread, so the number of shards only grows with the number of
+// threads running at once, not with the number ever started.
+static int pool_thread_index = -1;
+#ifdef _OPENMP
+#pragma omp threadprivate(pool_thread_index)
+#endif
+static int pool_nthreads = 0;
+static std::vector<int> pool_free_indices;
+
+#ifdef _OPENMP
+// There is no OpenMP hook for a thread exiting, so use a pthread key,
+// whose destructor is called when the thread exits.  The value stored
+// is index+1, since the destructor isn't called for a null value.
+static pthread_key_t pool_thread_key;
+static pthread_once_t pool_thread_key_once = PTHREAD_ONCE_INIT;
+
+static void ReleasePoolThreadIndex(void* p)
+{
+    int i = int(reinterpret_cast<long>(p)) - 1;
+#pragma omp critical (PoolThreadIndex)
+    {
+        pool_free_indices.push_back(i);
+    }
+}
+
+static void MakePoolThreadKey()
+{ pthread_key_create(&pool_thread_key,&ReleasePoolThreadIndex); }
+#endif
+
+static int GetPoolThreadIndex()
+{
+    if (pool_thread_index < 0) {
+#ifdef _OPENMP
+#pragma omp critical (PoolThreadIndex)
+#endif
+        {
+            if (pool_free_indices.empty()) {
+                pool_thread_index = pool_nthreads++;
+            } else {
+                pool_thread_index = pool_free_indices.back();
+                pool_free_indices.pop_back();
+            }
+        }
+#ifdef _OPENMP
+        pthread_once(&pool_thread_key_once,&MakePoolThreadKey);
+        pthread_setspecific(
+            pool_thread_key,reinterpret_cast<void*>(pool_thread_index+1L));
+#endif
+    }
+    return pool_thread_index;
+}
+
+static inline PoolBlock* GetPoolBlock(void* p)
+{
+    return reinterpret_cast<PoolBlock*>(
+        static_cast<char*>(p) - sizeof(PoolBlock));
+}
+
+// The owner of blocks from the shared pool.
+static const int SHARED_OWNER = -1;
+
+template <int blockSize>
+struct PoolShard
+{
+    Pool<blockSize> pool;
+
+    // Memory freed by other threads, waiting to be returned to pool.
+    std::vector<void*> remote_free;
+    // Checked without the lock, so the owner doesn't need to lock
+    // unless there is something to do.  If it reads a stale 0, the
+    // memory is just freed a bit later.
+    volatile int npending;
+    // For the shared pool, this also protects pool itself.
+#ifdef _OPENMP
+    omp_lock_t lock;
+#endif
+
+    // Statistics
+    long nalloc;
+    long nfree;
+    long nremote;
+
+    // Don't allocate a block until this thread actually uses the pool.
+    // Otherwise every thread would add a block to the process's virtual
+    // memory, which is what the multishear memory checks measure.
+    PoolShard() : pool(false), npending(0), nalloc(0), nfree(0), nremote(0)
+    {
+#ifdef _OPENMP
+        omp_init_lock(&lock);
+#endif
+    }
+
+    ~PoolShard()
+    {
+#ifdef _OPENMP
+        omp_destroy_lock(&lock);
+#endif
+    }
+
+    void pushRemote(void* p)
+    {
+#ifdef _OPENMP
+        omp_set_lock(&lock);
+#endif
+        remote_free.push_back(p);
+        npending = remote_free.size();
+        ++nremote;
+#ifdef _OPENMP
+        omp_unset_lock(&lock);
+#endif
+    }
+
+    void drainRemote()
+    {
+        if (npending == 0) return;
+        std::vector<void*> temp;
+#ifdef _OPENMP
+        omp_set_lock(&lock);
+#endif
+        temp.swap(remote_free);
+        npending = 0;
+#ifdef _OPENMP
+        omp_unset_lock(&lock);
+#endif
+        const int ntemp = temp.size();
+        for(int i=0;i<ntemp;++i) pool.deallocate(temp[i]);
+        nfree += ntemp;
+    }
+
+    // These are used for the shared pool, which any thread may use.
+    void* lockedAllocate(size_t size)
+    {
+        void* p;
+#ifdef _OPENMP
+        omp_set_lock(&lock);
+#endif
+        try {
+            p = pool.allocate(size);
+        } catch (...) {
+#ifdef _OPENMP
+            omp_unset_lock(&lock);
+#endif
+            throw;
+        }
+        ++nalloc;
+#ifdef _OPENMP
+        omp_unset_lock(&lock);
+#endif
+        return p;
+    }
+
+    void lockedDeallocate(void* p)
+    {
+#ifdef _OPENMP
+        omp_set_lock(&lock);
+#endif
+        pool.deallocate(p);
+        ++nfree;
+#ifdef _OPENMP
+        omp_unset_lock(&lock);
+#endif
+    }
+};
+
+template <int blockSize>
+ShardedPool<blockSize>::ShardedPool() : _shared(new PoolShard<blockSize>())
+{
+    for(int i=0;i<MAX_SHARDS;++i) _shards[i] = 0;
+}
+
+template <int blockSize>
+ShardedPool<blockSize>::~ShardedPool()
+{
+    for(int i=0;i<MAX_SHARDS;++i) delete _shards[i];
+    delete _shared;
+}
+
+template <int blockSize>
+PoolShard<ShardedPool<blockSize>::SHARD_BLOCK>*
+ShardedPool<blockSize>::getShard(int i)
+{
+    // Only the thread with this index ever writes to _shards[i], so
+    // this doesn't need a lock.  Other threads only read _shards[i]
+    // when freeing memory that came from it, at which point it has
+    // long since been set.  When an index is reused by a new thread,
+    // the new thread takes over the shard, including any memory that
+    // is still in use from the old one.
+    if (!_shards[i]) _shards[i] = new PoolShard<SHARD_BLOCK>();
+    return _shards[i];
+}
+
+template <int blockSize>
+long long ShardedPool<blockSize>::totalMemoryUsed() const
+{
+    long long tot = _shared->pool.totalMemoryUsed();
+    for(int i=0;i<MAX_SHARDS;++i)
+        if (_shards[i]) tot += _shards[i]->pool.totalMemoryUsed();
+    return tot;
+}
+
+template <int blockSize>
+void* ShardedPool<blockSize>::allocate(size_t size)
+{
+    const int i = GetPoolThreadIndex();
+    if (i >= MAX_SHARDS || size + sizeof(PoolBlock) > MAX_SHARD_ALLOC) {
+        void* p = _shared->lockedAllocate(size);
+        GetPoolBlock(p)->owner = SHARED_OWNER;
+        return p;
+    }
+    PoolShard<SHARD_BLOCK>* shard = getShard(i);
+    shard->drainRemote();
+    void* p = shard->pool.allocate(size);
+    GetPoolBlock(p)->owner = i;
+    ++shard->nalloc;
+    return p;
+}
+
+template <int blockSize>
+void ShardedPool<blockSize>::deallocate(void* p, size_t)
+{
+    if (!p) return;
+    int owner = GetPoolBlock(p)->owner;
+    if (owner == SHARED_OWNER) {
+        _shared->lockedDeallocate(p);
+        return;
+    }
+    Assert(owner >= 0 && owner < MAX_SHARDS && _shards[owner]);
+    if (owner == GetPoolThreadIndex()) {
+        PoolShard<SHARD_BLOCK>& shard = *_shards[owner];
+        shard.pool.deallocate(p);
+        ++shard.nfree;
+        // A thread that is only freeing things should still return
+        // what the other threads freed for it.
+        shard.drainRemote();
+    } else {
+        _shards[owner]->pushRemote(p);
+    }
+}
+
+template <int blockSize>
+void ShardedPool<blockSize>::dump(std::ostream& os)
+{
+    for(int i=0;i<MAX_SHARDS;++i) if (_shards[i]) {
+        os<<"Shard "<<i<<":\n";
+        _shards[i]->pool.dump(os);
+    }
+    os<<"Shared:\n";
+    _shared->pool.dump(os);
+}
+
+template <int blockSize>
+void ShardedPool<blockSize>::summary(std::ostream& os)
+{
+    for(int i=0;i<MAX_SHARDS;++i) if (_shards[i]) {
+        os<<"Shard "<<i<<":\n";
+        _shards[i]->pool.summary(os);
+    }
+    os<<"Shared:\n";
+    _shared->pool.summary(os);
+    stats(os);
+}
+
+template <int blockSize>
+void ShardedPool<blockSize>::stats(std::ostream& os) const
+{
+    os<<"ShardedPool<"<<blockSize<<"> stats:\n";
+    for(int i=0;i<MAX_SHARDS;++i) if (_shards[i]) {
+        const PoolShard<SHARD_BLOCK>& s = *_shards[i];
+        os<<"  thread "<<i<<": nalloc = "<<s.nalloc<<
+            ", nfree = "<<s.nfree<<
+            ", nfree by other threads = "<<s.nremote<<
+            ", memory = "<<s.pool.totalMemoryUsed()/(1024*1024)<<" MB\n";
+    }
+    os<<"  shared: nalloc = "<<_shared->nalloc<<
+        ", nfree = "<<_shared->nfree<<
+        ", memory = "<<_shared->pool.totalMemoryUsed()/(1024*1024)<<" MB\n";
+}
+
+template <int blockSize>
+void ShardedPool<blockSize>::reclaim()
+{
+    for(int i=0;i<MAX_SHARDS;++i) if (_shards[i]) {
+        // Any remote frees still pending would keep the blocks from
+        // being reclaimed, so do them first.
+        _shards[i]->drainRemote();
+        _shards[i]->pool.reclaim();
+    }
+    _shared->pool.reclaim();
+}
+
+template class ShardedPool<PIXELLIST_BLOCK>;
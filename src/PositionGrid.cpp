@@ -0,0 +1,85 @@
+
+#include <algorithm>
+#include <cmath>
+#include "PositionGrid.h"
+#include "dbg.h"
+
+PositionGrid::PositionGrid(const std::vector<Position>& pos, int nper_cell) :
+    _nx(1), _ny(1), _dx(1.), _dy(1.)
+{
+    Assert(nper_cell > 0);
+    const int n = pos.size();
+    for(int i=0;i<n;++i) _bounds += pos[i];
+
+    if (n > 0) {
+        // Make the cells roughly square.
+        double width = _bounds.getXMax() - _bounds.getXMin();
+        double height = _bounds.getYMax() - _bounds.getYMin();
+        double ncells = std::max(1.,double(n)/nper_cell);
+        if (width > 0. && height > 0.) {
+            double cell = std::sqrt(width*height/ncells);
+            _nx = std::max(1,std::min(int(width/cell)+1,n));
+            _ny = std::max(1,std::min(int(height/cell)+1,n));
+        } else if (width > 0.) {
+            _nx = std::max(1,int(ncells));
+        } else if (height > 0.) {
+            _ny = std::max(1,int(ncells));
+        }
+        if (width > 0.) _dx = width / _nx;
+        if (height > 0.) _dy = height / _ny;
+    }
+    xdbg<<"PositionGrid: n = "<<n<<", nx,ny = "<<_nx<<','<<_ny<<std::endl;
+
+    // Counting sort by cell.  Within each cell, the indices stay in 
+    // increasing order.
+    const int ncell = _nx*_ny;
+    std::vector<int> cell(n);
+    _start.assign(ncell+1,0);
+    for(int i=0;i<n;++i) {
+        cell[i] = getCellX(pos[i].getX()) + getCellY(pos[i].getY())*_nx;
+        ++_start[cell[i]+1];
+    }
+    for(int c=0;c<ncell;++c) _start[c+1] += _start[c];
+    std::vector<int> next(_start.begin(),_start.end()-1);
+    _index.resize(n);
+    _pos.resize(n);
+    for(int i=0;i<n;++i) {
+        const int k = next[cell[i]]++;
+        _index[k] = i;
+        _pos[k] = pos[i];
+    }
+}
+
+int PositionGrid::getCellX(double x) const
+{
+    int ix = int(std::floor((x - _bounds.getXMin()) / _dx));
+    return std::max(0,std::min(ix,_nx-1));
+}
+
+int PositionGrid::getCellY(double y) const
+{
+    int iy = int(std::floor((y - _bounds.getYMin()) / _dy));
+    return std::max(0,std::min(iy,_ny-1));
+}
+
+void PositionGrid::findInBounds(const Bounds& b, std::vector<int>& index) const
+{
+    index.clear();
+    if (!b.isDefined() || !_bounds.isDefined()) return;
+    // (Not Bounds::intersects, since that excludes touching edges.)
+    if (b.getXMax() < _bounds.getXMin() || b.getXMin() > _bounds.getXMax() ||
+        b.getYMax() < _bounds.getYMin() || b.getYMin() > _bounds.getYMax()) 
+        return;
+
+    const int ix1 = getCellX(b.getXMin());
+    const int ix2 = getCellX(b.getXMax());
+    const int iy1 = getCellY(b.getYMin());
+    const int iy2 = getCellY(b.getYMax());
+    for(int iy=iy1;iy<=iy2;++iy) for(int ix=ix1;ix<=ix2;++ix) {
+        const int c = ix + iy*_nx;
+        for(int k=_start[c];k<_start[c+1];++k) {
+            if (b.includes(_pos[k])) index.push_back(_index[k]);
+        }
+    }
+    std::sort(index.begin(),index.end());
+}
@@ -0,0 +1,40 @@
+#ifndef PositionGrid_H
+#define PositionGrid_H
+
+#include <vector>
+#include "Bounds.h"
+
+// A flat grid over a fixed list of positions, for finding all of the 
+// positions within some Bounds without checking every one.
+// The grid keeps its own copy of the positions, so it stays valid if the
+// original list goes away, but it doesn't see any later changes to it.
+class PositionGrid
+{
+public :
+
+    // The grid is sized to have about nper_cell positions per cell.
+    PositionGrid(const std::vector<Position>& pos, int nper_cell=8);
+
+    // Set index to the indices of all the positions with b.includes(pos),
+    // in increasing order.
+    void findInBounds(const Bounds& b, std::vector<int>& index) const;
+
+    int size() const { return _index.size(); }
+
+private :
+
+    int getCellX(double x) const;
+    int getCellY(double y) const;
+
+    Bounds _bounds;
+    int _nx, _ny;
+    double _dx, _dy;
+
+    // The positions sorted by cell.  The positions in cell (ix,iy) are
+    // [_start[ix+iy*_nx], _start[ix+iy*_nx+1]).
+    std::vector<int> _start;
+    std::vector<int> _index;
+    std::vector<Position> _pos;
+};
+
+#endif
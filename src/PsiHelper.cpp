@@ -1,5 +1,6 @@
 
 #include <vector>
+#include <algorithm>
 #include "PsiHelper.h"
 #include "dbg.h"
 #include "Params.h"
@@ -19,6 +20,16 @@
 // use the TMV and EIGEN macros.
 
 void MakePsi(DMatrix& psi, CDVectorView z, int order, const DVectorView* coeff)
+{
+    Assert(psi.colsize() == z.size());
+    DVector zr = z.realPart();
+    DVector zi = z.imagPart();
+    MakePsi(psi,zr.view(),zi.view(),order,coeff);
+}
+
+static void ScalarMakePsi(
+    DMatrix& psi, DVectorView zr, DVectorView zi, int order,
+    const DVectorView* coeff)
 {
     // For p>=q:
     //
@@ -38,27 +49,29 @@ void MakePsi(DMatrix& psi, CDVectorView z, int order, const DVectorView* coeff)
     // psi_00 = 1/sqrt(pi) exp(-r^2/2)
 
     Assert(int(psi.rowsize()) >= (order+1)*(order+2)/2);
-    Assert(psi.colsize() == z.size());
+    Assert(psi.colsize() == zr.size());
+    Assert(zi.size() == zr.size());
     if (coeff) Assert(psi.colsize() == coeff->size());
     Assert(psi.iscm());
     Assert(!psi.isconj());
+    Assert(zr.step() == 1);
+    Assert(zi.step() == 1);
 
     const double invsqrtpi = 1./sqrtpi;
 
-    // Setup rsq, z vectors and set psi_00
-    DVector rsq(z.size());
+    // Setup rsq vector and set psi_00
+    const int zsize = zr.size();
+    DVector rsq(zsize);
     double* rsqit = rsq.ptr();
     double* psi00it = psi.ptr();
-    const std::complex<double>* zit = z.cptr();
-    const int zsize = z.size();
+    const double* zrit = zr.cptr();
+    const double* ziit = zi.cptr();
     for(int i=0;i<zsize;++i) {
-        rsqit[i] = std::norm(zit[i]);
+        rsqit[i] = zrit[i]*zrit[i] + ziit[i]*ziit[i];
         psi00it[i] = invsqrtpi * exp(-(rsqit[i])/2.);
     }
     if (coeff) psi.col(0) *= DiagMatrixViewOf(*coeff);
 
-    DVector zr = z.realPart();
-    DVector zi = z.imagPart();
     if (order >= 1) {
         // Set psi_10
         // All m > 0 elements are intrinsically complex.
@@ -148,7 +161,7 @@ void MakePsi(DVector& psi, std::complex<double> z, int order)
     }
 }
 
-void AugmentPsi(DMatrix& psi, CDVectorView z, int order)
+static void ScalarAugmentPsi(DMatrix& psi, CDVectorView z, int order)
 {
     Assert(int(psi.rowsize()) >= (order+3)*(order+4)/2);
     Assert(psi.colsize() == z.size());
@@ -195,7 +208,17 @@ void AugmentPsi(DMatrix& psi, CDVectorView z, int order)
 
 #else
 
-void MakePsi(DMatrix& psi, CDVectorView z, int order, const DVector* coeff)
+void MakePsi(DMatrix& psi, CDVectorView z, int order, const DVectorView* coeff)
+{
+    Assert(psi.TMV_colsize() == z.size());
+    DVector zr = z.TMV_realPart();
+    DVector zi = z.TMV_imagPart();
+    MakePsi(psi,TMV_vview(zr),TMV_vview(zi),order,coeff);
+}
+
+static void ScalarMakePsi(
+    DMatrix& psi, DVectorView zr, DVectorView zi, int order,
+    const DVectorView* coeff)
 {
     // For p>=q:
     //
@@ -215,27 +238,27 @@ void MakePsi(DMatrix& psi, CDVectorView z, int order, const DVector* coeff)
     // psi_00 = 1/sqrt(pi) exp(-r^2/2)
 
     Assert(int(psi.TMV_rowsize()) >= (order+1)*(order+2)/2);
-    Assert(psi.TMV_colsize() == z.size());
+    Assert(psi.TMV_colsize() == zr.size());
+    Assert(zi.size() == zr.size());
     if (coeff) Assert(psi.TMV_colsize() == coeff->size());
     //Assert(psi.iscm());
     //Assert(!psi.isconj());
 
     const double invsqrtpi = 1./sqrtpi;
 
-    // Setup rsq, z vectors and set psi_00
-    DVector rsq(z.size());
+    // Setup rsq vector and set psi_00
+    const int zsize = zr.size();
+    DVector rsq(zsize);
     double* rsqit = TMV_ptr(rsq);
     double* psi00it = TMV_ptr(psi);
-    const std::complex<double>* zit = TMV_cptr(z);
-    const int zsize = z.size();
+    const double* zrit = TMV_cptr(zr);
+    const double* ziit = TMV_cptr(zi);
     for(int i=0;i<zsize;++i) {
-        rsqit[i] = std::norm(zit[i]);
+        rsqit[i] = zrit[i]*zrit[i] + ziit[i]*ziit[i];
         psi00it[i] = invsqrtpi * exp(-(rsqit[i])/2.);
     }
     if (coeff) psi.col(0) = coeff->cwise() * psi.col(0);
 
-    DVector zr = z.TMV_realPart();
-    DVector zi = z.TMV_imagPart();
     if (order >= 1) {
         // Set psi_10
         // All m > 0 elements are intrinsically complex.
@@ -330,7 +353,7 @@ void MakePsi(DVector& psi, std::complex<double> z, int order)
     }
 }
 
-void AugmentPsi(DMatrix& psi, CDVectorView z, int order)
+static void ScalarAugmentPsi(DMatrix& psi, CDVectorView z, int order)
 {
     Assert(int(psi.TMV_rowsize()) >= (order+3)*(order+4)/2);
     Assert(psi.TMV_colsize() == z.size());
@@ -381,6 +404,327 @@ void AugmentPsi(DMatrix& psi, CDVectorView z, int order)
 
 #endif
 
+//
+// Vectorized versions of MakePsi and AugmentPsi.
+//
+// The above implementations work one column of psi at a time through the
+// matrix library.  The kernel below does the same recursion directly on 
+// the column-major storage of psi, a block of pixels at a time, so the 
+// inner loops run over contiguous pixels with no aliasing between the 
+// inputs and outputs.  The compiler then evaluates them for 4 (AVX2) or
+// 8 (AVX-512) pixels at once.
+//
+// The same kernel is compiled for each instruction set, and the best one
+// that the cpu supports is chosen at runtime.  If none of them are 
+// available (or we aren't using a compiler that can do this), the 
+// versions above are used.  The results agree with those to within
+// rounding errors, but not bit for bit, since the operations are done
+// in a slightly different order (and with fused multiply-adds).
+//
+
+#if defined(__GNUC__) && !defined(__clang__) && !defined(__INTEL_COMPILER) \
+    && !defined(__PGI) && (defined(__x86_64__) || defined(__i386__)) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define PSI_KERNEL_DISPATCH
+#endif
+
+#ifdef PSI_KERNEL_DISPATCH
+
+// The number of pixels to do at a time.  The recursion reaches back
+// about 4N columns, so this keeps the active part of psi in cache.
+#define PSI_BLOCK 128
+
+#define PSI_INLINE inline __attribute__((always_inline))
+
+static PSI_INLINE void PsiKernelZCol(
+    double* __restrict__ dest, 
+    const double* __restrict__ zr, const double* __restrict__ zi,
+    const double* __restrict__ src1, const double* __restrict__ src2,
+    double a, int n)
+{
+    // dest = a * (zr*src1 + zi*src2)
+    for(int i=0;i<n;++i) dest[i] = a * (zr[i]*src1[i] + zi[i]*src2[i]);
+}
+
+static PSI_INLINE void PsiKernelRsqCol(
+    double* __restrict__ dest, const double* __restrict__ rsq,
+    const double* __restrict__ src, double nm1, double a, int n)
+{
+    // dest = a * (rsq-(N-1)) * src
+    for(int i=0;i<n;++i) dest[i] = a * (rsq[i]*src[i] - nm1*src[i]);
+}
+
+static PSI_INLINE void PsiKernelRsqCol2(
+    double* __restrict__ dest, const double* __restrict__ rsq,
+    const double* __restrict__ src, const double* __restrict__ src2,
+    double nm1, double a, double b, int n)
+{
+    // dest = a * (rsq-(N-1)) * src - b * src2
+    for(int i=0;i<n;++i) 
+        dest[i] = a * (rsq[i]*src[i] - nm1*src[i]) - b*src2[i];
+}
+
+// Calculate the columns of psi for radial orders N = order1..order2.
+// If order1 == 0, this starts from scratch, including the optional 
+// coeff factor.  Otherwise, the columns for lower orders are assumed to 
+// already be set.  ld is the column stride of psi.
+static PSI_INLINE void PsiKernelBody(
+    double* psi, int ld, const double* zr, const double* zi,
+    const double* coeff, int npix, int order1, int order2)
+{
+    const double invsqrtpi = 1./sqrtpi;
+    double rsq[PSI_BLOCK];
+    double mzi[PSI_BLOCK];
+
+    for(int i0=0;i0<npix;i0+=PSI_BLOCK) {
+        const int n = std::min(PSI_BLOCK,npix-i0);
+        const double* zrb = zr + i0;
+        const double* zib = zi + i0;
+        double* psib = psi + i0;
+        for(int i=0;i<n;++i) {
+            rsq[i] = zrb[i]*zrb[i] + zib[i]*zib[i];
+            mzi[i] = -zib[i];
+        }
+
+        int N = order1;
+        if (N == 0) {
+            double* psi00 = psib;
+            for(int i=0;i<n;++i) psi00[i] = invsqrtpi * exp(-rsq[i]/2.);
+            if (coeff) {
+                const double* coeffb = coeff + i0;
+                for(int i=0;i<n;++i) psi00[i] *= coeffb[i];
+            }
+            if (order2 >= 1) {
+                // See the comments in the above versions about the 2's.
+                double* psi10r = psib + ld;
+                double* psi10i = psib + 2*ld;
+                for(int i=0;i<n;++i) {
+                    psi10r[i] = 2. * zrb[i] * psi00[i];
+                    psi10i[i] = -2. * zib[i] * psi00[i];
+                }
+            }
+            N = 2;
+        }
+        for(int k=N*(N+1)/2;N<=order2;++N) {
+            // psi_N0
+            const double sqrt_1_N = sqrt(1./N);
+            PsiKernelZCol(psib+k*ld,zrb,zib,psib+(k-N)*ld,psib+(k-N+1)*ld,
+                          sqrt_1_N,n);
+            PsiKernelZCol(psib+(k+1)*ld,zrb,mzi,psib+(k-N+1)*ld,psib+(k-N)*ld,
+                          sqrt_1_N,n);
+            k+=2;
+
+            // psi_pq with q>0
+            const double nm1 = N-1.;
+            for(int m=N-2,p=N-1,q=1;m>=0;--p,++q,m-=2) {
+                const double pq = p*q;
+                const double a = 1./sqrt(pq);
+                const int ncol = (m==0) ? 1 : 2;
+                for(int j=0;j<ncol;++j,++k) {
+                    if (q > 1) {
+                        const double b = sqrt(1.-nm1/pq);
+                        PsiKernelRsqCol2(psib+k*ld,rsq,psib+(k-2*N-1)*ld,
+                                         psib+(k+2-4*N)*ld,nm1,a,b,n);
+                    } else {
+                        PsiKernelRsqCol(psib+k*ld,rsq,psib+(k-2*N-1)*ld,
+                                        nm1,a,n);
+                    }
+                }
+            }
+        }
+    }
+}
+
+typedef void (*PsiKernelFunc)(
+    double* psi, int ld, const double* zr, const double* zi,
+    const double* coeff, int npix, int order1, int order2);
+
+__attribute__((target("avx2,fma")))
+static void PsiKernelAvx2(
+    double* psi, int ld, const double* zr, const double* zi,
+    const double* coeff, int npix, int order1, int order2)
+{ PsiKernelBody(psi,ld,zr,zi,coeff,npix,order1,order2); }
+
+__attribute__((target("avx512f,avx2,fma")))
+static void PsiKernelAvx512(
+    double* psi, int ld, const double* zr, const double* zi,
+    const double* coeff, int npix, int order1, int order2)
+{ PsiKernelBody(psi,ld,zr,zi,coeff,npix,order1,order2); }
+
+static bool CpuSupportsPsiKernel(PsiKernelType type)
+{
+    __builtin_cpu_init();
+    switch (type) {
+      case PSI_KERNEL_AVX512 :
+           return __builtin_cpu_supports("avx512f");
+      case PSI_KERNEL_AVX2 :
+           return __builtin_cpu_supports("avx2") && 
+               __builtin_cpu_supports("fma");
+      default :
+           return type == PSI_KERNEL_SCALAR;
+    }
+}
+
+static PsiKernelFunc GetPsiKernelFunc(PsiKernelType type)
+{
+    switch (type) {
+      case PSI_KERNEL_AVX512 : return &PsiKernelAvx512;
+      case PSI_KERNEL_AVX2 : return &PsiKernelAvx2;
+      default : return 0;
+    }
+}
+
+#else
+
+static bool CpuSupportsPsiKernel(PsiKernelType type)
+{ return type == PSI_KERNEL_SCALAR; }
+
+#endif
+
+static PsiKernelType BestPsiKernel()
+{
+    if (CpuSupportsPsiKernel(PSI_KERNEL_AVX512)) return PSI_KERNEL_AVX512;
+    else if (CpuSupportsPsiKernel(PSI_KERNEL_AVX2)) return PSI_KERNEL_AVX2;
+    else return PSI_KERNEL_SCALAR;
+}
+
+static PsiKernelType psi_kernel = BestPsiKernel();
+
+PsiKernelType SetPsiKernel(PsiKernelType type)
+{
+    if (type == PSI_KERNEL_AUTO || !CpuSupportsPsiKernel(type)) 
+        type = BestPsiKernel();
+    psi_kernel = type;
+    return psi_kernel;
+}
+
+PsiKernelType GetPsiKernel() 
+{ return psi_kernel; }
+
+void MakePsi(
+    DMatrix& psi, DVectorView zr, DVectorView zi, int order,
+    const DVectorView* coeff)
+{
+#ifdef PSI_KERNEL_DISPATCH
+    // The kernel needs psi to be column-major and the vectors to be
+    // contiguous.  This is always true for the way we call this, but
+    // just in case, use the regular version if not.
+    bool contiguous = TMV_stepi(psi) == 1;
+#ifdef USE_TMV
+    contiguous = contiguous && !psi.isconj() && 
+        zr.step() == 1 && zi.step() == 1 && (!coeff || coeff->step() == 1);
+#endif
+    PsiKernelFunc kernel = GetPsiKernelFunc(psi_kernel);
+    if (kernel && contiguous) {
+        Assert(int(psi.TMV_rowsize()) >= (order+1)*(order+2)/2);
+        Assert(psi.TMV_colsize() == zr.size());
+        Assert(zi.size() == zr.size());
+        if (coeff) Assert(psi.TMV_colsize() == coeff->size());
+        const int npix = zr.size();
+        if (npix == 0) return;
+        (*kernel)(
+            TMV_ptr(psi),TMV_stepj(psi),TMV_cptr(zr),TMV_cptr(zi),
+            coeff ? TMV_cptr(*coeff) : 0, npix, 0, order);
+        return;
+    }
+#endif
+    ScalarMakePsi(psi,zr,zi,order,coeff);
+}
+
+void AugmentPsi(DMatrix& psi, CDVectorView z, int order)
+{
+#ifdef PSI_KERNEL_DISPATCH
+    bool contiguous = TMV_stepi(psi) == 1;
+#ifdef USE_TMV
+    contiguous = contiguous && !psi.isconj();
+#endif
+    PsiKernelFunc kernel = GetPsiKernelFunc(psi_kernel);
+    if (kernel && contiguous) {
+        Assert(int(psi.TMV_rowsize()) >= (order+3)*(order+4)/2);
+        Assert(psi.TMV_colsize() == z.size());
+        Assert(order >= 1);
+        const int npix = z.size();
+        if (npix == 0) return;
+        DVector zr = z.TMV_realPart();
+        DVector zi = z.TMV_imagPart();
+        (*kernel)(
+            TMV_ptr(psi),TMV_stepj(psi),TMV_cptr(zr),TMV_cptr(zi),
+            0, npix, order+1, order+2);
+        return;
+    }
+#endif
+    ScalarAugmentPsi(psi,z,order);
+}
+
+// Add v * G to X, where G is set up by the given function.
+static void AddG(
+    DMatrix& X, void (*setup)(DMatrix&, int, int), double v,
+    int order1, int order2)
+{
+    if (v == 0.) return;
+    DMatrix G(int(X.TMV_colsize()),int(X.TMV_rowsize()));
+    (*setup)(G,order1,order2);
+    X += v * G;
+}
+
+// X is the derivative of psi along the vector field
+// dx = v02 + v00 x + v01 y, dy = v12 + v10 x + v11 y,
+// mapping psi at order2 to psi at order1.
+static void SetupGV(DMatrix& X, const double V[3][3], int order1, int order2)
+{
+    X.setZero();
+    AddG(X,&SetupGx,V[0][2],order1,order2);
+    AddG(X,&SetupGy,V[1][2],order1,order2);
+    AddG(X,&SetupGmu,(V[0][0]+V[1][1])/2.,order1,order2);
+    AddG(X,&SetupGg1,(V[0][0]-V[1][1])/2.,order1,order2);
+    AddG(X,&SetupGg2,(V[0][1]+V[1][0])/2.,order1,order2);
+    AddG(X,&SetupGth,(V[1][0]-V[0][1])/2.,order1,order2);
+}
+
+void UpdatePsi(
+    DMatrix& psi, const DMatrix& psi0, int order,
+    std::complex<double> dz, std::complex<double> alpha, 
+    std::complex<double> beta)
+{
+    const int size0 = (order+1)*(order+2)/2;
+    const int size2 = (order+3)*(order+4)/2;
+    const int size4 = (order+5)*(order+6)/2;
+    Assert(int(psi0.TMV_rowsize()) >= size4);
+    Assert(int(psi.TMV_rowsize()) >= size0);
+    Assert(psi.TMV_colsize() == psi0.TMV_colsize());
+
+    // Write z' = z + dz + alpha z + beta z* as an affine map acting 
+    // on (x,y,1): M = 1 + A.
+    const double A[3][3] = {
+        { real(alpha)+real(beta), imag(beta)-imag(alpha), real(dz) },
+        { imag(alpha)+imag(beta), real(alpha)-real(beta), imag(dz) },
+        { 0., 0., 0. } };
+
+    // M = exp(V), where V = log(1+A) = A - A^2/2 + O(A^3).
+    // Following the vector field V for unit time takes z to z', and 
+    // along the way, d(psi)/dt = psi X, where X is the same combination 
+    // of the G matrices.  So psi(z') = psi(z) exp(X).
+    double V[3][3];
+    for(int i=0;i<3;++i) for(int j=0;j<3;++j) {
+        V[i][j] = A[i][j];
+        for(int k=0;k<3;++k) V[i][j] -= 0.5 * A[i][k] * A[k][j];
+    }
+
+    // Each X raises the order by at most 2, so to second order:
+    // psi(z') = psi0(z) (1 + X + X^2/2), 
+    // where psi0 goes up to order+4.
+    DMatrix X1(size2,size0);
+    SetupGV(X1,V,order+2,order);
+    DMatrix X2(size4,size2);
+    SetupGV(X2,V,order+4,order+2);
+    DMatrix T = X2 * X1;
+    T *= 0.5;
+    T.TMV_subMatrix(0,size2,0,size0) += X1;
+    for(int i=0;i<size0;++i) T(i,i) += 1.;
+
+    TMV_colRange(psi,0,size0) = TMV_colRange(psi0,0,size4) * T;
+}
+
 void SetupGx(DMatrix& Gx, int order1, int order2)
 {
     Assert(int(Gx.TMV_colsize()) == (order1+1)*(order1+2)/2);
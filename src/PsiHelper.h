@@ -1,6 +1,7 @@
 #ifndef PSIHELPER_H
 #define PSIHELPER_H
 
+#include <complex>
 #include "MyMatrix.h"
 
 // Here is the order of p,q along the indices of psi:
@@ -19,6 +20,14 @@
 void MakePsi(
     DMatrix& psi, CDVectorView z, int order, const DVectorView* coeff=0);
 
+// Same thing, but with the real and imaginary parts of z given as 
+// separate vectors.  This is the form that the column-oriented 
+// PixelColumns produce directly, so it avoids packing them into a 
+// complex vector just to unpack them again here.
+void MakePsi(
+    DMatrix& psi, DVectorView zr, DVectorView zi, int order,
+    const DVectorView* coeff=0);
+
 // Same thing, but for a single pixel.
 void MakePsi(DVector& psi, std::complex<double> z, int order);
 
@@ -27,6 +36,35 @@ void MakePsi(DVector& psi, std::complex<double> z, int order);
 // So the result is a psi matrix for order+2.
 void AugmentPsi(DMatrix& psi, CDVectorView z, int order);
 
+// Make the psi matrix for positions that have moved by a small
+// (real-linear) transformation from the ones used for psi0:
+//   z -> z + dz + alpha z + beta z*
+// psi0 is the psi matrix for the original positions, made by MakePsi
+// at order+4 (including any coefficient for each row), and psi is
+// set to the psi matrix at order.
+// This uses the derivative operators below to second order, so the 
+// error is third order in the size of the transformation.  It is meant
+// for steps up to about 0.01 (with z in units of sigma); for larger 
+// ones, just call MakePsi again.
+void UpdatePsi(
+    DMatrix& psi, const DMatrix& psi0, int order,
+    std::complex<double> dz, std::complex<double> alpha, 
+    std::complex<double> beta);
+
+// MakePsi and AugmentPsi use a vectorized kernel when the cpu supports
+// AVX2 or AVX-512.  The best available one is selected automatically,
+// but a particular one may be requested with SetPsiKernel.  (This is 
+// mostly useful for testing.)  If the requested kernel isn't supported 
+// by the cpu, the best available one is used instead.  The return value
+// is the kernel that will actually be used.  PSI_KERNEL_SCALAR is the 
+// non-vectorized version.
+// Don't call SetPsiKernel while other threads might be calling MakePsi.
+enum PsiKernelType { 
+    PSI_KERNEL_AUTO, PSI_KERNEL_SCALAR, PSI_KERNEL_AVX2, PSI_KERNEL_AVX512 
+};
+PsiKernelType SetPsiKernel(PsiKernelType type);
+PsiKernelType GetPsiKernel();
+
 // Gx = d(psi)/dx.  Likewise for the other parameters.
 void SetupGx(DMatrix& Gx, int order1, int order2);
 void SetupGy(DMatrix& Gy, int order1, int order2);
@@ -1,5 +1,6 @@
 
 #include <iostream>
+#include <algorithm>
 
 #include "ShearCatalog.h"
 #include "ConfigFile.h"
@@ -18,12 +19,11 @@
 #undef _OPENMP
 #endif
 
-static bool GetPixPsf(
+static bool GetPix(
     const Image<double>& im, PixelList& pix,
     const Position pos, double sky, double noise,
     const Image<double>* weight_image, const Transformation& trans,
-    const ConfigFile& params, long& flags,
-    const FittedPsf& fitpsf, BVec& psf, ShearLog& log)
+    const ConfigFile& params, long& flags, ShearLog& log)
 {
     double max_aperture = params.read<double>("shear_max_aperture");
     // Get the main PixelList for this galaxy:
@@ -47,21 +47,67 @@ static bool GetPixPsf(
         flags |= TRANSFORM_EXCEPTION;
         return false;
     }
+    return true;
+}
 
-    // Get the interpolated psf for this galaxy:
-    try {
-        psf = fitpsf(pos);
-    } catch (RangeException& e) {
-        dbg<<"fittedpsf range error: \n";
-        xdbg<<"p = "<<pos<<", b = "<<e.getBounds()<<std::endl;
-        ++log._nf_range2;
-        dbg<<"FLAG FITTEDPSF_EXCEPTION\n";
-        flags |= FITTEDPSF_EXCEPTION;
-        return false;
+// Return the distance along a Hilbert curve filling a 2^16 x 2^16 grid
+// to the grid point (x,y).
+static unsigned int HilbertIndex(unsigned int x, unsigned int y)
+{
+    const unsigned int n = 1<<16;
+    unsigned int d = 0;
+    for (unsigned int s=n/2; s>0; s/=2) {
+        unsigned int rx = (x & s) > 0;
+        unsigned int ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant appropriately.
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s-1 - (x & (s-1));
+                y = s-1 - (y & (s-1));
+            }
+            std::swap(x,y);
+        }
     }
-    return true;
+    return d;
+}
+
+struct KeySorter
+{
+    const std::vector<unsigned int>& _key;
+    KeySorter(const std::vector<unsigned int>& key) : _key(key) {}
+    bool operator()(int i, int j) const { return _key[i] < _key[j]; }
+};
+
+// Galaxy catalogs are usually ordered by magnitude or by detection,
+// so consecutive galaxies are all over the image, which means each
+// GetPixList reads rows that aren't in the cache.
+// Return the galaxy indices in order along a Hilbert curve over the 
+// positions instead, so nearby galaxies are measured together.
+// (The effect on cache misses has not been measured, which is why this
+// is off by default.)
+static void GetSpatialOrder(
+    const std::vector<Position>& pos, int ngals, std::vector<int>& order)
+{
+    Bounds b;
+    for(int i=0;i<ngals;++i) b += pos[i];
+    const double xmin = b.getXMin();
+    const double ymin = b.getYMin();
+    double size = std::max(b.getXMax()-xmin, b.getYMax()-ymin);
+    if (!(size > 0.)) size = 1.;
+    const double scale = ((1<<16)-1) / size;
+
+    std::vector<unsigned int> key(ngals);
+    for(int i=0;i<ngals;++i) {
+        unsigned int ix = (unsigned int)((pos[i].getX()-xmin)*scale);
+        unsigned int iy = (unsigned int)((pos[i].getY()-ymin)*scale);
+        key[i] = HilbertIndex(ix,iy);
+    }
+    order.resize(ngals);
+    for(int i=0;i<ngals;++i) order[i] = i;
+    std::stable_sort(order.begin(),order.end(),KeySorter(key));
 }
- 
+
 int ShearCatalog::measureShears(
     const Image<double>& im,
     const Image<double>* weight_image, ShearLog& log)
@@ -82,7 +128,9 @@ int ShearCatalog::measureShears(
     {
         if (first) {
             // initialize random seed:
-            // NB: This will only stay deterministic if not using openmp.
+            // NB: This will only stay deterministic if not using openmp,
+            // unless shear_deterministic is set, in which case rand()
+            // isn't used.
             unsigned int seed=0;
             for (int i=0;i<this->size(); i++) {
                 seed += i*_flags[i];
@@ -99,6 +147,8 @@ int ShearCatalog::measureShears(
     // Read some needed parameters
     bool output_dots = _params.read("output_dots",false);
     bool des_qa = _params.read("des_qa",false); 
+    bool deterministic = _params.read("shear_deterministic",false);
+    unsigned long seed = _params.read("shear_random_seed",0UL);
 
     // This need to have been set.
     Assert(_trans);
@@ -122,6 +172,29 @@ int ShearCatalog::measureShears(
     dbg<<log._ngoodin<<"/"<<log._ngals<<" galaxies with no input flags\n";
     std::vector<Position> initPos = _pos;
 
+    // Optionally measure the galaxies in a spatially coherent order.
+    // The results are still stored by the original index.
+    std::vector<int> order;
+    if (_params.read("shear_spatial_order",false)) {
+        GetSpatialOrder(_pos,ngals,order);
+    } else {
+        order.resize(ngals);
+        for(int i=0;i<ngals;++i) order[i] = i;
+    }
+
+    // Interpolate the psf for all the galaxies at once, rather than
+    // one at a time in the loop.
+    std::vector<int> psf_index(ngals,-1);
+    std::vector<BVec> all_psf;
+    {
+        std::vector<Position> psf_pos;
+        for(int i=0;i<ngals;++i) if (!_flags[i]) {
+            psf_index[i] = psf_pos.size();
+            psf_pos.push_back(_pos[i]);
+        }
+        _fitpsf->interpolateMany(psf_pos,all_psf);
+    }
+
     // Main loop to measure shapes
 #ifdef _OPENMP
 #pragma omp parallel 
@@ -137,7 +210,8 @@ int ShearCatalog::measureShears(
 #ifdef _OPENMP
 #pragma omp for schedule(dynamic)
 #endif
-            for(int i=0;i<ngals;++i) {
+            for(int k=0;k<ngals;++k) {
+                const int i = order[k];
                 if (_flags[i]) {
                     xdbg<<i<<" skipped because has flag "<<_flags[i]<<std::endl;
                     continue;
@@ -146,8 +220,7 @@ int ShearCatalog::measureShears(
                 if (i < STARTAT) continue;
 #endif
 #ifdef SINGLEGAL
-                if (i < SINGLEGAL) continue;
-                if (i > SINGLEGAL) break;
+                if (i != SINGLEGAL) continue;
 #endif
                 if (output_dots) {
 #ifdef _OPENMP
@@ -160,14 +233,16 @@ int ShearCatalog::measureShears(
                 dbg<<"galaxy "<<i<<":\n";
                 dbg<<"pos = "<<_pos[i]<<std::endl;
 
-                if (!GetPixPsf(
+                if (!GetPix(
                         im,pix[0],_pos[i],_sky[i],_noise[i],weight_image,
-                        *_trans,_params,_flags[i],
-                        *_fitpsf,psf[0],log1)) {
+                        *_trans,_params,_flags[i],log1)) {
                     continue;
                 }
+                Assert(psf_index[i] >= 0);
+                psf[0] = all_psf[psf_index[i]];
 
                 // Now measure the shape and shear:
+                CounterRng rng(seed,_id[i]);
                 MeasureSingleShear(
                     // Input data:
                     pix, psf,
@@ -176,7 +251,8 @@ int ShearCatalog::measureShears(
                     // Log information
                     log1,
                     // Ouput values:
-                    _shape[i], _shear[i], _cov[i], _nu[i], _flags[i]);
+                    _shape[i], _shear[i], _cov[i], _nu[i], _flags[i],
+                    deterministic ? &rng : 0);
 
 
                 if (!_flags[i]) {
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <vector>
@@ -641,6 +642,7 @@ void StarCatalog::readFits(std::string file)
 
     dbg<<"  "<<id_col<<std::endl;
     table.column(id_col).read(_id, start, end);
+    _id_index.clear();
     dbg<<"  "<<x_col<<"  "<<y_col<<std::endl;
     table.column(x_col).read(x, start, end);
     table.column(y_col).read(y, start, end);
@@ -675,6 +677,7 @@ void StarCatalog::readAscii(std::string file, std::string delim)
 
     _id.clear(); _pos.clear(); _sky.clear(); _noise.clear(); _flags.clear();
     _mag.clear(); _sg.clear(); _objsize.clear(); _is_star.clear();
+    _id_index.clear();
 
     if (delim == "  ") {
         ConvertibleString flag;
@@ -770,15 +773,56 @@ void StarCatalog::read()
 }
 
 
+void StarCatalog::buildIdIndex() const
+{
+    const int nobj = _id.size();
+    _id_index.resize(nobj);
+    for(int i=0;i<nobj;++i) _id_index[i] = std::make_pair(_id[i],i);
+    // Sorting the pairs also sorts duplicate ids by index, so isStar
+    // finds the first one, as a linear search would.
+    std::sort(_id_index.begin(),_id_index.end());
+}
+
 bool StarCatalog::isStar(long id) const
 {
-    std::vector<long>::const_iterator p = find(_id.begin(),_id.end(),id);
-    if (p == _id.end()) return false;
-    int i = p - _id.begin();
+    if (_id_index.size() != _id.size()) buildIdIndex();
+    std::vector<std::pair<long,int> >::const_iterator p = 
+        std::lower_bound(_id_index.begin(),_id_index.end(),
+                         std::make_pair(id,0));
+    if (p == _id_index.end() || p->first != id) return false;
+    int i = p->second;
     Assert(i < int(_is_star.size()));
     return _is_star[i];
 }
 
+static bool isSorted(const std::vector<long>& v)
+{
+    const int n = v.size();
+    for(int i=1;i<n;++i) if (v[i] < v[i-1]) return false;
+    return true;
+}
+
+void StarCatalog::isStarMany(
+    const std::vector<long>& ids, std::vector<bool>& is_star) const
+{
+    const int n = ids.size();
+    const int nobj = _id.size();
+    Assert(int(_is_star.size()) == nobj);
+    is_star.assign(n,false);
+    if (isSorted(ids) && isSorted(_id)) {
+        xdbg<<"isStarMany: merging sorted id lists\n";
+        int j=0;
+        for(int i=0;i<n;++i) {
+            while (j < nobj && _id[j] < ids[i]) ++j;
+            if (j == nobj) break;
+            if (_id[j] == ids[i]) is_star[i] = _is_star[j];
+        }
+    } else {
+        xdbg<<"isStarMany: using id index\n";
+        for(int i=0;i<n;++i) is_star[i] = isStar(ids[i]);
+    }
+}
+
 void StarCatalog::printall(int i) 
 {
     if (int(_id.size()) > i) {
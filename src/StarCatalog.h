@@ -94,8 +94,16 @@ public:
     // some other catalog that wants to use it, so the i's don't have to match.
     // But the ID's should still refer to the same objects.
     // If you know you have the same i values, getIsStar is faster.
+    // The lookup uses a sorted index of the ids, which is built on 
+    // the first call.  (So the first call is not thread safe.)
     bool isStar(long id) const;
 
+    // The same for a list of ids: is_star[i] = isStar(ids[i]).
+    // If both lists of ids are sorted, which is the usual case, this 
+    // is a single pass through each list.
+    void isStarMany(
+        const std::vector<long>& ids, std::vector<bool>& is_star) const;
+
     void printall(int i);
 
 private :
@@ -112,6 +120,11 @@ private :
     std::vector<double> _objsize;
     std::vector<bool> _is_star;
 
+    // Sorted (id,index) pairs used by isStar.
+    // This needs to be cleared whenever _id changes.
+    mutable std::vector<std::pair<long,int> > _id_index;
+    void buildIdIndex() const;
+
     //const ConfigFile& _params;
     // We need to be able to alter this if we want to write alternative
     // names.  So we'll make our own copy
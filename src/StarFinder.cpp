@@ -160,72 +160,8 @@ std::vector<PotentialStar*> StarFinder::findStars(
             dbg<<probstars[k]->getMag()<<" "<<probstars[k]->getSize()<<std::endl;
         }
     } else {
-        for(int i=0;i<nsection;++i) {
-            dbg<<"i = "<<i<<": bounds = "<<qbounds[i]<<std::endl;
-
-            // someobj are the objects in this section
-            // Note that someobj is automatically sorted by magnitude, since
-            // allobj was sorted.
-            std::vector<PotentialStar*> someobj;
-            for(int k=0;k<nobj;++k) {
-                if (qbounds[i].includes(allobj[k]->getPos())) 
-                    someobj.push_back(allobj[k]);
-            }
-            dbg<<"added "<<someobj.size()<<" obj\n";
-
-            // Does a really quick and dirty fit to the bright stars
-            // Basically it takes the 10 smallest of the 50 brightest objects,
-            // finds the peakiest 5, then fits their sizes to a 1st order function.
-            // It also gives us a rough value for the sigma
-            Legendre2D flinear(qbounds[i]);
-            double sigma;
-            roughlyFitBrightStars(someobj,&flinear,&sigma);
-            dbg<<"fit bright stars: sigma = "<<sigma<<std::endl;
-
-            // Calculate the min and max values of the (adjusted) sizes
-            double min_size,max_size;
-            findMinMax(someobj,&min_size,&max_size,flinear);
-            dbg<<"min,max = "<<min_size<<','<<max_size<<std::endl;
-
-            // Find the objects clustered around the stellar peak.
-            std::vector<PotentialStar*> qpeak_list =
-                getPeakList(
-                    someobj,_bin_size1,min_size,max_size,
-                    int(_nstart1*someobj.size()),_min_iter1,_mag_step1,_max_ratio1,
-                    true,flinear);
-            const int npeak = qpeak_list.size();
-            dbg<<"peaklist has "<<npeak<<" stars\n";
-
-            // Remove outliers using a median,percentile rejection scheme.
-            // _bin_size1/2. is the minimum value of "sigma".
-            rejectOutliers(qpeak_list,_reject1,_bin_size1/2.,flinear);
-            dbg<<"rejected outliers, now have "<<npeak<<" stars\n";
-
-            // Use at most 10 (stars_per_bin) stars per region to prevent one region 
-            // from dominating the fit.  Use the 10 brightest stars to prevent being
-            // position biased (as one would if it were based on size
-            int nstars_expected = int(_star_frac * someobj.size());
-            if (npeak < nstars_expected) {
-                if (npeak < int(0.2 * nstars_expected)) {
-                    if (_des_qa) {
-                        std::cout<<"STATUS3BEG Warning: Only "<<
-                            qpeak_list.size()<<" stars found in section "<<
-                            i<<". STATUS3END"<<std::endl;
-                    }
-                    dbg<<"Warning: only "<<qpeak_list.size()<<
-                        " stars found in section "<<i<<
-                        "  "<<qbounds[i]<<std::endl;
-                }
-                probstars.insert(probstars.end(),qpeak_list.begin(),qpeak_list.end());
-            } else {
-                std::sort(qpeak_list.begin(),qpeak_list.end(),
-                          std::mem_fun(&PotentialStar::isBrighterThan));
-                probstars.insert(probstars.end(),qpeak_list.begin(),
-                                 qpeak_list.begin()+nstars_expected);
-            }
-            dbg<<"added to probstars\n";
-        }
-        xdbg<<"done qbounds loop\n";
+        // The sections are independent, so this is done in parallel.
+        findStarsInSections(allobj,qbounds,probstars);
     }
     int nstars = probstars.size();
     dbg<<"nstars = "<<nstars<<std::endl;
@@ -364,6 +300,56 @@ std::vector<PotentialStar*> StarFinder::findStars(
     return probstars;
 }
 
+void StarFinder::findSectionStars(
+    const std::vector<PotentialStar*>& someobj, const Bounds& bounds,
+    std::vector<PotentialStar*>& section_stars, bool& too_few)
+{
+    // someobj are the objects in this section, sorted by magnitude.
+    too_few = false;
+
+    // Does a really quick and dirty fit to the bright stars
+    // Basically it takes the 10 smallest of the 50 brightest objects,
+    // finds the peakiest 5, then fits their sizes to a 1st order function.
+    // It also gives us a rough value for the sigma
+    Legendre2D flinear(bounds);
+    double sigma;
+    roughlyFitBrightStars(someobj,&flinear,&sigma);
+    dbg<<"fit bright stars: sigma = "<<sigma<<std::endl;
+
+    // Calculate the min and max values of the (adjusted) sizes
+    double min_size,max_size;
+    findMinMax(someobj,&min_size,&max_size,flinear);
+    dbg<<"min,max = "<<min_size<<','<<max_size<<std::endl;
+
+    // Find the objects clustered around the stellar peak.
+    std::vector<PotentialStar*> qpeak_list =
+        getPeakList(
+            someobj,_bin_size1,min_size,max_size,
+            int(_nstart1*someobj.size()),_min_iter1,_mag_step1,_max_ratio1,
+            true,flinear);
+    const int npeak = qpeak_list.size();
+    dbg<<"peaklist has "<<npeak<<" stars\n";
+
+    // Remove outliers using a median,percentile rejection scheme.
+    // _bin_size1/2. is the minimum value of "sigma".
+    rejectOutliers(qpeak_list,_reject1,_bin_size1/2.,flinear);
+    dbg<<"rejected outliers, now have "<<npeak<<" stars\n";
+
+    // Use at most 10 (stars_per_bin) stars per region to prevent one region 
+    // from dominating the fit.  Use the 10 brightest stars to prevent being
+    // position biased (as one would if it were based on size
+    int nstars_expected = int(_star_frac * someobj.size());
+    if (npeak < nstars_expected) {
+        if (npeak < int(0.2 * nstars_expected)) too_few = true;
+        section_stars = qpeak_list;
+    } else {
+        std::sort(qpeak_list.begin(),qpeak_list.end(),
+                  std::mem_fun(&PotentialStar::isBrighterThan));
+        section_stars.assign(
+            qpeak_list.begin(),qpeak_list.begin()+nstars_expected);
+    }
+}
+
 void StarFinder::findMinMax(
     const std::vector<PotentialStar*>& list, 
     double *min, double *max, const Function2D& f)
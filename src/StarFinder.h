@@ -24,6 +24,17 @@ public :
     std::vector<PotentialStar*> findStars(
         std::vector<PotentialStar*>& allobj);
 
+    // Find the probable stars in each section of qbounds separately,
+    // and append them to probstars in section order.
+    void findStarsInSections(
+        const std::vector<PotentialStar*>& allobj,
+        const std::vector<Bounds>& qbounds,
+        std::vector<PotentialStar*>& probstars);
+
+    void findSectionStars(
+        const std::vector<PotentialStar*>& someobj, const Bounds& bounds,
+        std::vector<PotentialStar*>& section_stars, bool& too_few);
+
     void findMinMax(
         const std::vector<PotentialStar*>& list,
         double *min, double *max, const Function2D& f);
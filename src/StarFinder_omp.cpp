@@ -0,0 +1,99 @@
+
+#include <vector>
+#include <string>
+#include <new>
+#include "boost/shared_ptr.hpp"
+
+#include "StarFinder.h"
+#include "Bounds.h"
+#include "PotentialStar.h"
+
+// Can't throw out of a parallel region, so each section keeps a copy of
+// what it caught, and the first one is rethrown with its original type
+// after the loop.
+struct SectionError
+{
+    virtual ~SectionError() {}
+    virtual void rethrow() const = 0;
+};
+
+template <class E>
+struct SectionErrorT : public SectionError
+{
+    SectionErrorT(const E& e) : _e(e) {}
+    void rethrow() const { throw _e; }
+    E _e;
+};
+
+void StarFinder::findStarsInSections(
+    const std::vector<PotentialStar*>& allobj,
+    const std::vector<Bounds>& qbounds,
+    std::vector<PotentialStar*>& probstars)
+{
+    const int nobj = allobj.size();
+    const int nsection = qbounds.size();
+
+    // Each section only reads allobj and writes its own entries here.
+    // Then they are merged in section order below, so the result doesn't
+    // depend on the number of threads.
+    std::vector<std::vector<PotentialStar*> > section_stars(nsection);
+    std::vector<int> section_nobj(nsection,0);
+    std::vector<char> too_few(nsection,false);
+    std::vector<boost::shared_ptr<SectionError> > error(nsection);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for(int i=0;i<nsection;++i) {
+        dbg<<"i = "<<i<<": bounds = "<<qbounds[i]<<std::endl;
+
+        // someobj are the objects in this section
+        // Note that someobj is automatically sorted by magnitude, since
+        // allobj was sorted.
+        std::vector<PotentialStar*> someobj;
+        for(int k=0;k<nobj;++k) {
+            if (qbounds[i].includes(allobj[k]->getPos())) 
+                someobj.push_back(allobj[k]);
+        }
+        section_nobj[i] = someobj.size();
+        dbg<<"added "<<someobj.size()<<" obj\n";
+
+        try {
+            bool too_few_i;
+            findSectionStars(someobj,qbounds[i],section_stars[i],too_few_i);
+            too_few[i] = too_few_i;
+        } catch (StarFinderException& e) {
+            error[i].reset(new SectionErrorT<StarFinderException>(e));
+        } catch (AssertFailureException& e) {
+            error[i].reset(new SectionErrorT<AssertFailureException>(e));
+        } catch (std::bad_alloc& e) {
+            error[i].reset(new SectionErrorT<std::bad_alloc>(e));
+        } catch (std::exception& e) {
+            // Anything else can only keep its message.
+            error[i].reset(new SectionErrorT<std::runtime_error>(
+                    std::runtime_error(e.what())));
+        }
+    }
+    xdbg<<"done qbounds loop\n";
+
+    for(int i=0;i<nsection;++i) {
+        if (error[i].get()) {
+            dbg<<"Error in section "<<i<<std::endl;
+            error[i]->rethrow();
+        }
+        if (too_few[i]) {
+            if (_des_qa) {
+                std::cout<<"STATUS3BEG Warning: Only "<<
+                    section_stars[i].size()<<" stars found in section "<<
+                    i<<". STATUS3END"<<std::endl;
+            }
+            dbg<<"Warning: only "<<section_stars[i].size()<<
+                " stars found in section "<<i<<
+                "  "<<qbounds[i]<<std::endl;
+        }
+        probstars.insert(
+            probstars.end(),section_stars[i].begin(),section_stars[i].end());
+        dbg<<"added "<<section_stars[i].size()<<" of "<<section_nobj[i]<<
+            " objects from section "<<i<<" to probstars\n";
+    }
+}
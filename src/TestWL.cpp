@@ -21,6 +21,8 @@
 #include "ShearCatalog.h"
 #include "PsiHelper.h"
 #include "BinomFact.h"
+#include "Function2D.h"
+#include "Legendre2D.h"
 
 #if defined (__INTEL_COMPILER) && defined(OPENMP_LINK)
 __thread std::ostream* dbgout = 0;
@@ -44,6 +46,10 @@ std::ostream* testout = &std::cout;
 //#define TEST5  // Use Ellipse's measure function
 //#define TEST6  // Test on real data images
 //#define TEST7  // Compare with Gary's shapelet code
+#define TEST8  // Compare vectorized MakePsi kernels with the scalar version
+#define TEST9  // Compare the BinomFact tables with direct calculations
+#define TEST10 // Compare Function2D evaluateMany with the scalar version
+#define TEST11 // Compare IncrementalPsi with rebuilding the psi matrices
 
 #ifdef TEST1
 #define TEST12
@@ -2390,6 +2396,220 @@ int main(int argc, char **argv) try
     std::cout<<"Passed tests against Gary's code.\n";
 #endif
 
+#ifdef TEST8
+    // Check that the vectorized MakePsi and AugmentPsi kernels match the 
+    // scalar versions to within rounding errors.
+    {
+        // Use a number of pixels that isn't a multiple of the vector
+        // length or the kernel's block size.
+        const int npix = 317;
+        const int psiorder = 14;
+        const int psisize = (psiorder+1)*(psiorder+2)/2;
+        CDVector z(npix);
+        DVector w(npix);
+        for(int i=0;i<npix;++i) {
+            z(i) = std::complex<double>(3.*sin(0.7*i),2.5*cos(1.3*i));
+            w(i) = 1. + 0.5*sin(double(i));
+        }
+        DVectorView wv = TMV_vview(w);
+
+        PsiKernelType best_kernel = GetPsiKernel();
+        dbg<<"Best MakePsi kernel = "<<best_kernel<<std::endl;
+        SetPsiKernel(PSI_KERNEL_SCALAR);
+        DMatrix psi0(npix,psisize);
+        MakePsi(psi0,TMV_vview(z),psiorder,&wv);
+        DMatrix psi0a(npix,psisize);
+        TMV_colRange(psi0a,0,psisize-2*psiorder-1) = 
+            TMV_colRange(psi0,0,psisize-2*psiorder-1);
+        AugmentPsi(psi0a,TMV_vview(z),psiorder-2);
+        double psinorm = TMV_Norm(psi0);
+        dbg<<"Norm(psi) = "<<psinorm<<std::endl;
+
+        PsiKernelType kernels[3] = 
+        { PSI_KERNEL_AUTO, PSI_KERNEL_AVX2, PSI_KERNEL_AVX512 };
+        for(int ik=0;ik<3;++ik) {
+            PsiKernelType kernel = SetPsiKernel(kernels[ik]);
+            dbg<<"Requested kernel "<<kernels[ik]<<", using "<<kernel<<std::endl;
+            DMatrix psi1(npix,psisize);
+            MakePsi(psi1,TMV_vview(z),psiorder,&wv);
+            double normdiff = TMV_Norm(psi1-psi0);
+            dbg<<"Norm(diff) = "<<normdiff<<std::endl;
+            Test(normdiff <= 1.e-12*psinorm,"Vectorized MakePsi");
+
+            DMatrix psi1a(npix,psisize);
+            TMV_colRange(psi1a,0,psisize-2*psiorder-1) = 
+                TMV_colRange(psi0,0,psisize-2*psiorder-1);
+            AugmentPsi(psi1a,TMV_vview(z),psiorder-2);
+            normdiff = TMV_Norm(psi1a-psi0a);
+            dbg<<"Norm(diff) = "<<normdiff<<std::endl;
+            Test(normdiff <= 1.e-12*psinorm,"Vectorized AugmentPsi");
+        }
+        SetPsiKernel(best_kernel);
+    }
+    std::cout<<"Passed tests of vectorized MakePsi.\n";
+#endif
+
+#ifdef TEST9
+    // Check fact, sqrtfact, binom and sqrtn against the plain recursions
+    // they used to be grown with, both within the precomputed tables and
+    // past the end of them (where they are calculated directly).
+    {
+        const int nmax = BINOMFACT_MAXN + 30;
+        std::vector<double> f(nmax+1), sf(nmax+1);
+        std::vector<std::vector<double> > b(nmax+1);
+        f[0] = sf[0] = 1.;
+        b[0] = std::vector<double>(1,1.);
+        for(int i=1;i<=nmax;++i) {
+            f[i] = f[i-1]*double(i);
+            sf[i] = sf[i-1]*std::sqrt(double(i));
+            b[i] = std::vector<double>(i+1,1.);
+            for(int j=1;j<i;++j) b[i][j] = b[i-1][j-1] + b[i-1][j];
+        }
+        // The factorials overflow to inf past 170, which is fine, since
+        // the recursion does the same thing.
+        for(int i=0;i<=nmax;++i) {
+            Test(fact(i) == f[i],"fact");
+            Test(sqrtfact(i) == sf[i],"sqrtfact");
+            Test(sqrtn(i) == std::sqrt(double(i)),"sqrtn");
+            for(int j=0;j<=i;++j) {
+                // Within the tables, binom is the same Pascal's triangle,
+                // so it is exact.  Past them, it is a product, which only
+                // agrees to a few ulp.
+                double tol = i <= BINOMFACT_MAXN ? 0. : 1.e-13*b[i][j];
+                Test(std::abs(binom(i,j)-b[i][j]) <= tol,"binom");
+            }
+            Test(binom(i,-1) == 0. && binom(i,i+1) == 0.,"binom out of range");
+        }
+    }
+    std::cout<<"Passed tests of BinomFact tables.\n";
+#endif
+
+#ifdef TEST10
+    // Check that evaluateMany matches the scalar operator() for 
+    // Polynomial2D and Legendre2D at several orders.
+    {
+        // Use a number of points that isn't a multiple of the block size.
+        const int npos = 203;
+        const Bounds bounds(0.,2048.,0.,4096.);
+        std::vector<Position> pos(npos);
+        for(int i=0;i<npos;++i) {
+            double x = 1024.*(1.+sin(0.7*i+0.3));
+            double y = 2048.*(1.+cos(1.3*i+0.1));
+            pos[i] = Position(x,y);
+        }
+        // Include the corners, where the Legendre polynomials are +-1.
+        pos[0] = Position(0.,0.);
+        pos[1] = Position(2048.,4096.);
+
+        for(int order=0;order<=6;++order) {
+            // The fits are usually of total order, with zeros past the
+            // diagonal, which evaluateMany skips.  Do both that and 
+            // full coefficient matrices.
+            for(int full=0;full<=1;++full) {
+                DMatrix c(order+1,order+1);
+                double cnorm = 0.;
+                for(int i=0;i<=order;++i) for(int j=0;j<=order;++j) {
+                    c(i,j) = (full || i+j <= order) ? sin(2.1*i+3.7*j+1.) : 0.;
+                    cnorm += std::abs(c(i,j));
+                }
+
+                Polynomial2D poly(c,1000.);
+                Legendre2D leg(bounds,c);
+                std::vector<double> fpoly, fleg;
+                poly.evaluateMany(pos,fpoly);
+                leg.evaluateMany(pos,fleg);
+                Test(int(fpoly.size()) == npos,"Polynomial2D evaluateMany size");
+                Test(int(fleg.size()) == npos,"Legendre2D evaluateMany size");
+
+                // |x/scale| <= 4.1, so the terms of the polynomial are
+                // up to 4.1^(2*order) times the coefficients.
+                double polynorm = cnorm * std::pow(4.1,2*order);
+                for(int i=0;i<npos;++i) {
+                    dbg<<"order = "<<order<<", pos = "<<pos[i]<<
+                        ": poly "<<fpoly[i]<<"  "<<poly(pos[i])<<
+                        ", leg "<<fleg[i]<<"  "<<leg(pos[i])<<std::endl;
+                    Test(std::abs(fpoly[i]-poly(pos[i])) <= 1.e-13*polynorm,
+                         "Polynomial2D evaluateMany");
+                    Test(std::abs(fleg[i]-leg(pos[i])) <= 1.e-13*cnorm,
+                         "Legendre2D evaluateMany");
+                }
+            }
+        }
+
+        // Points outside the bounds are an error for Legendre2D.
+        Legendre2D leg(bounds,DMatrix(2,2));
+        std::vector<Position> outside(1,Position(-1.,10.));
+        std::vector<double> f;
+        bool threw = false;
+        try {
+            leg.evaluateMany(outside,f);
+        } catch (RangeException&) {
+            threw = true;
+        }
+        Test(threw,"Legendre2D evaluateMany out of range");
+    }
+    std::cout<<"Passed tests of Function2D evaluateMany.\n";
+#endif
+
+#ifdef TEST11
+    // Check that the incremental psi matrices match the ones made from
+    // scratch.  The error of the update should be third order in the 
+    // change of frame, and a large change should rebuild them exactly.
+    {
+        const int npix = 317;
+        const int psiorder = 8;
+        const int psisize = (psiorder+1)*(psiorder+2)/2;
+        const double sigma = 1.5;
+        DVector w(npix);
+        std::vector<std::complex<double> > z(npix);
+        for(int i=0;i<npix;++i) {
+            z[i] = sigma*std::complex<double>(3.*sin(0.7*i),2.5*cos(1.3*i));
+            w(i) = 1. + 0.5*sin(double(i));
+        }
+        DVectorView wv = TMV_vview(w);
+
+        std::complex<double> cen0(0.2,-0.1);
+        std::complex<double> g0(0.15,-0.05);
+        double mu0 = 0.1;
+
+        IncrementalPsi inc(0.05);
+        double steps[4] = { 0., 1.e-2, 1.e-3, 0.2 };
+        double err[4];
+        for(int is=0;is<4;++is) {
+            const double s = steps[is];
+            std::complex<double> cen = 
+                cen0 + s*sigma*std::complex<double>(0.8,-0.6);
+            std::complex<double> g = g0 + s*std::complex<double>(0.5,0.7);
+            double mu = mu0 - 0.9*s;
+            std::complex<double> mm = exp(-mu)/sqrt(1.-std::norm(g));
+            std::complex<double> p = mm/sigma;
+            std::complex<double> q = -mm*g/sigma;
+            DVector zr(npix);
+            DVector zi(npix);
+            for(int i=0;i<npix;++i) {
+                std::complex<double> z1 = p*(z[i]-cen) + q*conj(z[i]-cen);
+                zr(i) = real(z1);
+                zi(i) = imag(z1);
+            }
+            DMatrix psi0(npix,psisize);
+            MakePsi(psi0,TMV_vview(zr),TMV_vview(zi),psiorder,&wv);
+            DMatrix psi1(npix,psisize);
+            inc.makePsi(0,psi1,TMV_vview(zr),TMV_vview(zi),psiorder,wv,
+                        cen,p,q);
+            err[is] = TMV_Norm(psi1-psi0) / TMV_Norm(psi0);
+            dbg<<"step = "<<s<<", relative error = "<<err[is]<<std::endl;
+        }
+        Test(err[0] <= 1.e-12,"IncrementalPsi initial build");
+        Test(err[1] <= 1.e-3,"IncrementalPsi update, step = 1.e-2");
+        Test(err[2] <= 1.e-6,"IncrementalPsi update, step = 1.e-3");
+        Test(err[2] <= 3.e-3*err[1],"IncrementalPsi third order error");
+        Test(err[3] <= 1.e-12,"IncrementalPsi rebuild for large step");
+        Test(inc.getNUpdates() == 2,"IncrementalPsi number of updates");
+        Test(inc.getNRebuilds() == 2,"IncrementalPsi number of rebuilds");
+    }
+    std::cout<<"Passed tests of IncrementalPsi.\n";
+#endif
+
     if (dbgout && dbgout != &std::cout) {delete dbgout; dbgout=0;}
     return 0;
 }
@@ -0,0 +1,72 @@
+
+// Time the fact, sqrtfact, binom and sqrtn functions with 1..64 threads.
+// These are used heavily in the shapelet transformations, so they need to 
+// scale well when many threads call them at once.
+//
+// Usage: time-binomfact [ncalls]
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <sys/time.h>
+#include "BinomFact.h"
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+// Go a bit past the precomputed tables, so the direct calculation is 
+// timed as well.
+const int MAXN = BINOMFACT_MAXN + 10;
+
+static double CallAll(int n)
+{
+    int i = n % (MAXN+1);
+    int j = (n/7) % (i+1);
+    return fact(i%171) + sqrtfact(i) + binom(i,j) + sqrtn(i);
+}
+
+static double GetTime()
+{
+    timeval tp;
+    gettimeofday(&tp,0);
+    return tp.tv_sec + tp.tv_usec/1.e6;
+}
+
+int main(int argc, char* argv[])
+{
+    const long ncalls = argc > 1 ? atol(argv[1]) : 10000000L;
+
+    // First check a few values, so we know we are timing the right thing.
+    if (fact(10) != 3628800. || binom(10,3) != 120. || 
+        binom(MAXN,1) != double(MAXN) || 
+        std::abs(sqrtfact(5)*sqrtfact(5) - 120.) > 1.e-10 ||
+        std::abs(sqrtn(MAXN)*sqrtn(MAXN) - MAXN) > 1.e-10) {
+        std::cerr<<"Error: wrong values from BinomFact functions\n";
+        return 1;
+    }
+
+    std::cout<<"Calls of fact+sqrtfact+binom+sqrtn: "<<ncalls<<std::endl;
+    std::cout<<std::setw(10)<<"nthreads"<<std::setw(14)<<"time (s)"<<
+        std::setw(20)<<"calls/s"<<std::endl;
+
+    for(int nthreads=1; nthreads<=64; nthreads*=2) {
+        double sum = 0.;
+        double t1 = GetTime();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) reduction(+ : sum)
+#endif
+        for(long n=0;n<ncalls;++n) sum += CallAll(n);
+        double t2 = GetTime();
+        std::cout<<std::setw(10)<<nthreads<<std::setw(14)<<t2-t1<<
+            std::setw(20)<<ncalls/(t2-t1);
+        // Print sum so the loop can't be optimized away.
+        if (!(sum > 0.)) std::cout<<"  (sum = "<<sum<<")";
+        std::cout<<std::endl;
+#ifndef _OPENMP
+        break;
+#endif
+    }
+    return 0;
+}
@@ -137,6 +137,21 @@ void Transformation::transform(Position pxy, Position& puv) const
     }
 }
 
+void Transformation::transformMany(
+    const std::vector<Position>& pxy, std::vector<Position>& puv) const
+{
+    const int n = pxy.size();
+    if (_u.get()) {
+        std::vector<double> u,v;
+        _u->evaluateMany(pxy,u);
+        _v->evaluateMany(pxy,v);
+        puv.resize(n);
+        for(int i=0;i<n;++i) puv[i] = Position(u[i],v[i]);
+    } else {
+        puv = pxy;
+    }
+}
+
 void Transformation::distort(
     Position pos, double& ixx, double& ixy, double& iyy) const
 {
@@ -247,18 +262,29 @@ bool Transformation::inverseTransform(Position puv, Position& pxy) const
     return success;
 }
 
+void Transformation::inverseTransformMany(
+    const std::vector<Position>& puv, std::vector<Position>& pxy,
+    std::vector<bool>& success) const
+{
+    const int n = puv.size();
+    Assert(int(pxy.size()) == n);
+    success.resize(n);
+    for(int i=0;i<n;++i) success[i] = inverseTransform(puv[i],pxy[i]);
+}
+
 
 //
 // makeInverseOf
 //
 
 Bounds Transformation::makeInverseOf(
-    const Transformation& t2, const Bounds& bounds, int order)
+    const Transformation& t2, const Bounds& bounds, int order,
+    double* max_error)
 {
     //int ngrid = 5*order;
-    int ngrid = order;
+    int ngrid = max_error ? 2*order : order;
     double dx = (bounds.getXMax() - bounds.getXMin()) / ngrid;
-    double dy = (bounds.getYMax() - bounds.getXMin()) / ngrid;
+    double dy = (bounds.getYMax() - bounds.getYMin()) / ngrid;
     int ntot = (ngrid+1)*(ngrid+1);
     Position puv;
     std::vector<Position> v_pos;
@@ -298,6 +324,32 @@ Bounds Transformation::makeInverseOf(
     _dvdy = _v->dFdY();
     _is_ra_dec = false;
 
+    if (max_error) {
+        // Check the round trip x,y -> u,v -> x,y on a finer grid.
+        const int nfine = 4*ngrid;
+        const double fdx = dx / 4.;
+        const double fdy = dy / 4.;
+        std::vector<Position> fine_xy;
+        fine_xy.reserve(nfine*nfine);
+        for(int i=0; i<nfine; ++i) {
+            double x1 = bounds.getXMin() + (i+0.5)*fdx;
+            for(int j=0; j<nfine; ++j) {
+                double y1 = bounds.getYMin() + (j+0.5)*fdy;
+                fine_xy.push_back(Position(x1,y1));
+            }
+        }
+        std::vector<Position> fine_uv, fine_xy2;
+        t2.transformMany(fine_xy,fine_uv);
+        transformMany(fine_uv,fine_xy2);
+        double maxerr = 0.;
+        for(size_t k=0; k<fine_xy.size(); ++k) {
+            double err = std::abs(fine_xy2[k] - fine_xy[k]);
+            if (!(err <= maxerr)) maxerr = err;
+        }
+        xdbg<<"max error of inverse = "<<maxerr<<std::endl;
+        *max_error = maxerr;
+    }
+
     return newbounds;
 }
 
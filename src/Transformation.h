@@ -2,6 +2,7 @@
 #define Transformation_H
 
 #include <stdexcept>
+#include <vector>
 #include "MyMatrix.h"
 #include "dbg.h"
 #include "Function2D.h"
@@ -36,6 +37,11 @@ public :
     Position operator()(Position pxy) const
     { Position puv; transform(pxy,puv); return puv; }
 
+    // The same for a list of positions.
+    // This is much faster than calling transform for each one.
+    void transformMany(
+        const std::vector<Position>& pxy, std::vector<Position>& puv) const;
+
     // Update second moments ixx -> iuu, etc. according to the 
     // jacobian of the transformation
     void distort(Position p, double& ixx, double& ixy, double& iyy) const;
@@ -55,14 +61,26 @@ public :
     // The return value indicates whether a solution was found.
     bool inverseTransform(Position pxy, Position& puv) const;
 
+    // The same for a list of positions.  puv are the targets, and pxy 
+    // the initial guesses on input.  success[i] is set to whether
+    // pxy[i] was solved.
+    void inverseTransformMany(
+        const std::vector<Position>& puv, std::vector<Position>& pxy,
+        std::vector<bool>& success) const;
+
     // Make this Transformation an approximate inverse of t2 using 
     // Legendre polynomials u to the given order in x,y.
     // The resulting transformation will be defined over a square
     // region in (u,v) that corresponds to the region given by
     // bounds in (x,y).
     // It returns the valid bounds for the new inverse transformation.
+    // If max_error is given, the fit uses a denser grid of points,
+    // and *max_error is set to the largest error in (x,y) of the
+    // inverse, measured at the centers of a grid 4 times finer still 
+    // (which includes all of the points farthest from the fitted ones).
     Bounds makeInverseOf(const Transformation& t2, 
-                         const Bounds& bounds, int order);
+                         const Bounds& bounds, int order,
+                         double* max_error=0);
 
 private :
 